@@ -0,0 +1,310 @@
+#include <iostream>
+#include <fstream>
+#include <format>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <functional>
+#include <algorithm>
+
+#include "njson.h"
+
+using namespace neroll;
+
+// every allocation of the process is counted, so a phase can report how
+// many it made
+namespace {
+    std::atomic<std::size_t> allocations{0};
+}
+
+void *operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size == 0 ? 1 : size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+    struct Corpus {
+        std::string name;
+        std::string json;
+        bool lines{false};  // NDJSON, one document per line
+    };
+
+    struct Result {
+        std::string corpus;
+        std::string phase;
+        std::size_t bytes;
+        std::size_t values;
+        double seconds;         // best run
+        double allocations;     // per document
+    };
+
+    // counts every value, keys are not values
+    struct ValueCounter {
+        std::size_t count{0};
+
+        void on_start_object() { count++; }
+        void on_end_object() {}
+        void on_start_array() { count++; }
+        void on_end_array() {}
+        void on_key(std::string_view) {}
+        void on_string(std::string_view) { count++; }
+        void on_int(std::int64_t) { count++; }
+        void on_double(double) { count++; }
+        void on_bool(bool) { count++; }
+        void on_null() { count++; }
+    };
+
+    // The corpora are generated from a fixed seed, so every run and every
+    // commit measures the same bytes.
+    class Generator {
+     public:
+        explicit Generator(std::size_t size) : size_(size) {}
+
+        Corpus numbers() {
+            std::string json = "[";
+            while (json.size() < size_) {
+                if (json.size() > 1)
+                    json += ',';
+                if (random_() % 2)
+                    json += std::to_string(static_cast<std::int64_t>(random_()) >> (random_() % 48));
+                else
+                    json += std::format("{}", std::uniform_real_distribution<double>(-1e6, 1e6)(random_));
+            }
+            json += ']';
+            return {"numbers", std::move(json)};
+        }
+
+        Corpus strings() {
+            std::string json = "[";
+            while (json.size() < size_) {
+                if (json.size() > 1)
+                    json += ',';
+                append_string(json, 8 + random_() % 120);
+            }
+            json += ']';
+            return {"strings", std::move(json)};
+        }
+
+        // arrays and objects nested 512 deep, repeated
+        Corpus nested() {
+            std::string json = "[";
+            while (json.size() < size_) {
+                if (json.size() > 1)
+                    json += ',';
+                for (int depth = 0; depth < 512; depth++)
+                    json += depth % 2 ? R"({"k":)" : "[";
+                json += std::to_string(random_() % 1000);
+                for (int depth = 511; depth >= 0; depth--)
+                    json += depth % 2 ? '}' : ']';
+            }
+            json += ']';
+            return {"nested", std::move(json)};
+        }
+
+        // one object with many members
+        Corpus wide() {
+            std::string json = "{";
+            for (std::size_t i = 0; json.size() < size_; i++) {
+                if (i != 0)
+                    json += ',';
+                json += std::format(R"("key{}":)", i);
+                json += std::to_string(random_() % 100000);
+            }
+            json += '}';
+            return {"wide", std::move(json)};
+        }
+
+        Corpus records() {
+            std::string json;
+            for (std::size_t id = 0; json.size() < size_; id++) {
+                json += std::format(R"({{"id":{},"user":)", id);
+                append_string(json, 12);
+                json += std::format(R"(,"score":{},"active":{},"tags":[)",
+                    std::uniform_real_distribution<double>(0, 100)(random_), random_() % 2 ? "true" : "false");
+                for (std::size_t i = 0, n = random_() % 5; i < n; i++) {
+                    if (i != 0)
+                        json += ',';
+                    append_string(json, 6);
+                }
+                json += "],\"parent\":null}\n";
+            }
+            return {"ndjson", std::move(json), true};
+        }
+
+     private:
+        std::size_t size_;
+        std::mt19937_64 random_{20240501};
+
+        void append_string(std::string &json, std::size_t length) {
+            static constexpr std::string_view letters = "abcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+            json += '"';
+            for (std::size_t i = 0; i < length; i++) {
+                auto pick = random_() % 64;
+                if (pick == 0)
+                    json += "\\n";
+                else if (pick == 1)
+                    json += "\\u00e9";
+                else
+                    json += letters[pick % letters.size()];
+            }
+            json += '"';
+        }
+    };
+
+    std::size_t count_values(const Corpus &corpus) {
+        ValueCounter counter;
+        if (!corpus.lines) {
+            Parser(Lexer{corpus.json}).parse(counter);
+            return counter.count;
+        }
+        std::size_t begin = 0;
+        while (begin < corpus.json.size()) {
+            auto end = corpus.json.find('\n', begin);
+            Parser(Lexer{std::string_view(corpus.json).substr(begin, end - begin)}).parse(counter);
+            begin = end + 1;
+        }
+        return counter.count;
+    }
+
+    // Runs `phase` once to warm up, then `runs` times. Keeps the best time
+    // and the allocations of one run.
+    Result measure(const Corpus &corpus, std::size_t values, std::string phase,
+            int runs, const std::function<void()> &work) {
+        work();
+        double best = 0;
+        std::size_t allocated = 0;
+        for (int i = 0; i < runs; i++) {
+            auto before = allocations.load();
+            auto start = std::chrono::steady_clock::now();
+            work();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            allocated = allocations.load() - before;
+            if (i == 0 || elapsed.count() < best)
+                best = elapsed.count();
+        }
+        std::size_t documents = 1;
+        if (corpus.lines)
+            documents = std::count(corpus.json.begin(), corpus.json.end(), '\n');
+        return {corpus.name, std::move(phase), corpus.json.size(), values, best,
+            static_cast<double>(allocated) / documents};
+    }
+
+    void bench(const Corpus &corpus, int runs, std::vector<Result> &results) {
+        auto values = count_values(corpus);
+
+        results.push_back(measure(corpus, values, "lex", runs, [&] {
+            Lexer lexer{corpus.json};
+            while (lexer.next_token().type != TokenType::END) {}
+        }));
+
+        results.push_back(measure(corpus, values, "lex_index", runs, [&] {
+            Lexer lexer{corpus.json};
+            lexer.build_index();
+            while (lexer.next_token().type != TokenType::END) {}
+        }));
+
+        if (corpus.lines) {
+            LinesParser parser({}, 1);
+            results.push_back(measure(corpus, values, "parse", runs, [&] {
+                parser.parse(corpus.json);
+            }));
+            return;
+        }
+
+        // the corpora are above ParseOptions::INDEX_THRESHOLD, so "parse"
+        // runs stage 1 and "parse_plain" shows what it gains
+        results.push_back(measure(corpus, values, "parse", runs, [&] {
+            Parser(Lexer{corpus.json}).parse();
+        }));
+
+        ParseOptions plain;
+        plain.index_threshold = SIZE_MAX;
+        results.push_back(measure(corpus, values, "parse_plain", runs, [&] {
+            Parser(Lexer{corpus.json}, plain).parse();
+        }));
+
+        auto document = Parser(Lexer{corpus.json}).parse();
+        std::string html;
+        results.push_back(measure(corpus, values, "to_html", runs, [&] {
+            html.clear();
+            StringSink sink(html);
+            Stringifier(document.root()).to_html(sink);
+        }));
+
+        JsonWriter writer;
+        results.push_back(measure(corpus, values, "to_json", runs, [&] {
+            writer.to_json(document.root());
+        }));
+    }
+
+    std::string to_json(const std::vector<Result> &results) {
+        std::string json = "[\n";
+        for (std::size_t i = 0; i < results.size(); i++) {
+            const auto &result = results[i];
+            json += std::format(R"(  {{"corpus": "{}", "phase": "{}", "bytes": {}, "values": {}, )"
+                R"("seconds": {}, "mb_per_s": {}, "ns_per_value": {}, "allocations_per_document": {}}})",
+                result.corpus, result.phase, result.bytes, result.values, result.seconds,
+                result.bytes / result.seconds / 1e6, result.seconds * 1e9 / result.values, result.allocations);
+            json += i + 1 < results.size() ? ",\n" : "\n";
+        }
+        json += "]\n";
+        return json;
+    }
+
+    void usage() {
+        std::cerr << "usage: njson_bench [--size MB] [--runs N] [--json FILE]\n";
+    }
+
+}
+
+int main(int argc, char **argv) {
+    std::size_t size = 16;
+    int runs = 5;
+    std::string json_path;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (i + 1 == argc) {
+            usage();
+            return 1;
+        }
+        if (arg == "--size") {
+            size = std::stoul(argv[++i]);
+        } else if (arg == "--runs") {
+            runs = std::stoi(argv[++i]);
+        } else if (arg == "--json") {
+            json_path = argv[++i];
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    Generator generator(size << 20);
+    std::vector<Result> results;
+    for (auto corpus : {generator.numbers(), generator.strings(), generator.nested(), generator.wide(), generator.records()})
+        bench(corpus, runs, results);
+
+    std::cout << std::format("{:<10}{:<12}{:>12}{:>14}{:>14}\n", "corpus", "phase", "MB/s", "ns/value", "allocs/doc");
+    for (const auto &result : results) {
+        std::cout << std::format("{:<10}{:<12}{:>12.1f}{:>14.2f}{:>14.1f}\n", result.corpus, result.phase,
+            result.bytes / result.seconds / 1e6, result.seconds * 1e9 / result.values, result.allocations);
+    }
+
+    if (!json_path.empty())
+        std::ofstream(json_path) << to_json(results);
+}
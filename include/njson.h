@@ -2,13 +2,25 @@
 #define __NEROLL_NJSON_H__
 
 #include <string>           // string
+#include <cstdint>          // uint64_t
+#include <bit>              // bit_cast
 #include <string_view>      // string_view
-#include <variant>          // variant
-#include <map>              // map
 #include <vector>           // vector
-#include <memory>           // shared_ptr
 #include <utility>          // pair
-#include <unordered_map>    // unordered_map
+#include <memory>           // unique_ptr
+#include <optional>         // optional
+#include <unordered_map>    // unordered_multimap
+#include <deque>            // deque
+#include <type_traits>      // is_same_v
+#include <functional>       // function
+#include <array>            // array
+#include <chrono>           // nanoseconds, steady_clock
+#include <tuple>            // tuple, apply
+#include <bitset>           // bitset
+#include <concepts>         // integral, floating_point
+#include <span>             // span
+#include <cstdio>           // fprintf
+#include <cstdlib>          // abort
 
 namespace neroll {
 
@@ -16,6 +28,7 @@ namespace neroll {
         NUMBER, TRUE, FALSE, NIL, STRING, END, COMMA, COLON,
         LBRACE, RBRACE,     // { }
         LBRACKET, RBRACKET, // [ ]
+        ERROR,      // invalid input, see Lexer::error()
     };
 
     const char *token_name(TokenType type);
@@ -23,23 +36,266 @@ namespace neroll {
     struct Token {
         std::string_view content;
         TokenType type;
-        std::size_t lineno; // which line
-        std::size_t colno;  // which column
+        std::size_t offset; // byte offset of the token in the input
+        bool escaped{false}; // string contains escape sequences
+
+        // value of a NUMBER token, converted while it is lexed
+        bool is_float{false};
+        std::int64_t integer{0};
+        double floating{0};
 
         const char *name() const;
     };
 
+    struct Location {
+        std::size_t line;   // which line, starting from 1
+        std::size_t column; // which column, starting from 1
+    };
+
+    enum class ErrorCode : std::uint8_t {
+        NONE,
+        // found by the lexer
+        INVALID_TOKEN,
+        INVALID_LITERAL,
+        INVALID_NUMBER,
+        LEADING_ZEROS,
+        NUMBER_OUT_OF_RANGE,
+        INVALID_STRING_CHARACTER,
+        INVALID_ESCAPE,
+        INVALID_UNICODE_ESCAPE,
+        UNPAIRED_LOW_SURROGATE,
+        UNPAIRED_HIGH_SURROGATE,
+        UNTERMINATED_STRING,
+        // found by the parser
+        INVALID_VALUE,
+        MISSING_COMMA_IN_ARRAY,
+        MISSING_COMMA_IN_OBJECT,
+        KEY_NOT_STRING,
+        MISSING_COLON,
+        DUPLICATE_KEY,
+        TOO_DEEP,
+        TRAILING_CONTENT,
+    };
+
+    // Why a parse failed. Recording one allocates nothing, the text of the
+    // message is only put together by message(), which needs the input to
+    // still be alive.
+    struct ParseError {
+        ErrorCode code{ErrorCode::NONE};
+        std::size_t offset{0};      // byte offset in the input
+        std::string_view source;    // the input
+        Location origin{1, 1};      // location of the first byte of the input
+        std::string_view text;      // the offending token or characters
+        TokenType found{TokenType::END};
+        std::size_t max_depth{0};   // for TOO_DEEP
+
+        explicit operator bool() const {
+            return code != ErrorCode::NONE;
+        }
+
+        // the message the throwing functions report for the same error
+        auto message() const -> std::string;
+    };
+
+    // Throws `exception`. In a build without exceptions (-fno-exceptions)
+    // it prints the message and aborts instead, so only the try_ functions
+    // can report errors there.
+    template <typename E>
+    [[noreturn]] void throw_exception(const E &exception) {
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS)
+        throw exception;
+#else
+        std::fprintf(stderr, "%s\n", exception.what());
+        std::abort();
+#endif
+    }
+
     std::ostream &operator<<(std::ostream &os, const Token &token);
 
+    // The output of stage 1 for a window [begin, end) of the input.
+    struct StructuralIndex {
+        std::size_t begin{0};
+        std::size_t end{0};
+        // offsets in the whole input, the first `count` are valid and the
+        // rest is room for the next window
+        std::vector<std::uint32_t> positions;
+        std::size_t count{0};
+        // one bit per byte of the window, set for quotes, backslashes and
+        // control characters: the bytes that end a string or need a closer
+        // look
+        std::vector<std::uint64_t> string_breaks;
+
+        // the first string break in [from, to), or `to`; both lie in the
+        // window
+        auto next_break(std::size_t from, std::size_t to) const -> std::size_t;
+    };
+
+    // Stage 1 of lexing: offsets of every structural character ({}[]:,) and
+    // of the first byte of every other token outside of strings, in 64-byte
+    // blocks. Uses AVX2 or SSE2 when available, plain C++ otherwise.
+    auto find_structurals(std::string_view json) -> std::vector<std::uint32_t>;
+
+    // The same for the `size` bytes of `json` from `begin`, or the rest of
+    // it, into `index`, keeping the capacity of its buffers. `begin` must
+    // not be inside a string or a token.
+    void find_structurals(std::string_view json, std::size_t begin, std::size_t size, StructuralIndex &index);
+
+    // What a piece of the input does to the container depth, for threads
+    // that each scan a piece of one input. Whether a piece starts inside a
+    // string depends on the pieces before it, so the depth is counted both
+    // ways and the pieces are chained afterwards: a piece starts inside a
+    // string if the ones before it hold an odd number of quotes.
+    struct RangeSummary {
+        bool odd_quotes{false};         // of the unescaped quotes in the piece
+        std::int64_t depth[2]{};        // change, starting outside [0] or inside [1] a string
+        std::int64_t min_depth[2]{};    // lowest change on the way, at most 0
+    };
+
+    // the summary of json[begin, end), in 64-byte blocks like stage 1
+    auto summarize_range(std::string_view json, std::size_t begin, std::size_t end) -> RangeSummary;
+
+    // The first comma at depth 1, or the bracket that brings the depth to
+    // 0, in json[begin, end) when `begin` is at `depth` and inside a string
+    // or not; npos if there is neither.
+    auto find_top_level(std::string_view json, std::size_t begin, std::size_t end,
+        bool in_string, std::size_t depth) -> std::size_t;
+
+    // the same for the bracket alone
+    auto find_close(std::string_view json, std::size_t begin, std::size_t end,
+        bool in_string, std::size_t depth) -> std::size_t;
+
+    // Decode the escape sequences of a string body that the lexer accepted
+    // and append the result to `out` as UTF-8.
+    void unescape(std::string_view body, std::string &out);
+
+    // The value of a STRING token: its body, or the body decoded into
+    // `scratch` if it contains escape sequences.
+    auto string_value(const Token &token, std::string &scratch) -> std::string_view;
+
+#ifdef NJSON_STATS
+    inline constexpr bool STATS_ENABLED = true;
+#else
+    inline constexpr bool STATS_ENABLED = false;
+#endif
+
+    // What a Lexer, Parser or Stringifier has done so far, collected only
+    // when NJSON_STATS is defined. Counts add up over every call made on
+    // the object.
+    struct Stats {
+        std::array<std::size_t, 13> tokens{};   // by TokenType
+        std::size_t escapes{0};         // escape sequences in strings
+        std::size_t integers{0};
+        std::size_t floats{0};
+        std::size_t max_depth{0};       // deepest container nesting
+        std::size_t nodes{0};           // values, keys excluded
+        std::size_t bytes_allocated{0}; // tapes and string buffers of the documents
+        std::chrono::nanoseconds lex_time{0};
+        std::chrono::nanoseconds build_time{0};     // parsing without the lexing
+        std::chrono::nanoseconds render_time{0};
+    };
+
+    struct NoStats {};
+
+    // the member that holds the stats, empty without NJSON_STATS
+    using StatsStorage = std::conditional_t<STATS_ENABLED, Stats, NoStats>;
+
+    // Calls `update` on `storage` if stats are enabled. `update` must be a
+    // generic lambda, so that its body is not even compiled otherwise.
+    template <typename S, typename F>
+    void with_stats(S &storage, F &&update) {
+        if constexpr (STATS_ENABLED)
+            update(storage);
+    }
+
     class Lexer {
      public:
+        // bytes indexed by stage 1 at a time, see build_index()
+        static constexpr std::size_t INDEX_WINDOW = 64 * 1024;
+
         Lexer(std::string_view json)
-            : json_(json.data()), end_(json.data() + json.size()) {}
+            : begin_(json.data()), json_(json.data()), end_(json.data() + json.size()) {}
 
+        // the next token, throws std::runtime_error if it is invalid
         auto next_token() -> Token;
 
+        // The next token without throwing. Invalid input comes back as an
+        // ERROR token, and error() tells what is wrong with it.
+        auto try_next_token() -> Token;
+
+        auto error() const -> const ParseError & {
+            return error_;
+        }
+
+        // start over on `json`, keeping the capacity of the index buffers
+        void reset(std::string_view json);
+
+        // bytes held by the structural index
+        std::size_t memory_usage() const {
+            return index_.positions.capacity() * sizeof(std::uint32_t)
+                + index_.string_breaks.capacity() * sizeof(std::uint64_t);
+        }
+
+        // Lex with stage 1 from now on. Tokens start at the indexed
+        // positions: structural characters need no lexing, a string ends
+        // before the next position and only its escape sequences are
+        // checked, and numbers and literals are lexed at their offsets.
+        // Stage 1 runs one window ahead of the lexer, so the positions and
+        // the input are still in the cache when they are used. Produces
+        // exactly the same tokens and errors as the plain lexer. Parser
+        // calls it for inputs of ParseOptions::index_threshold bytes or more.
+        void build_index();
+
+        bool indexed() const {
+            return indexed_;
+        }
+
+        // try_next_token() of an indexed lexer, without the stats
+        auto next_indexed_token() -> Token;
+
+        // line and column of a byte offset, counted when asked for
+        auto location(std::size_t offset) const -> Location;
+
+        // report locations as if the input started at `origin`, for input
+        // that is a piece of a larger text
+        void set_origin(Location origin) {
+            origin_ = origin;
+        }
+
+        Location origin() const {
+            return origin_;
+        }
+
+        std::string_view source() const {
+            return {begin_, static_cast<std::size_t>(end_ - begin_)};
+        }
+
+        // byte offset of the next character to lex
+        auto offset() const -> std::size_t {
+            return json_ - begin_;
+        }
+
+        // continue lexing at `offset`, which must be the start of a token
+        // or whitespace
+        void seek(std::size_t offset);
+
+        // Called after the { or [ of a container, moves past its closing
+        // bracket by matching brackets outside of strings. The contents are
+        // not lexed, so they are not validated either.
+        void skip_container();
+
+        // throws unless `token` can start a value
+        void expect_value(const Token &token) const;
+
+        // all zero without NJSON_STATS
+        auto stats() const -> Stats;
+
+        // moves past the rest of a value whose first token was just lexed
+        void skip_value(const Token &first);
+
+        [[noreturn]] void throw_error(std::size_t offset, std::string_view message) const;
 
      private:
+        auto lex_token() -> Token;
         auto parse_true() -> Token;
         auto parse_false() -> Token;
         auto parse_null() -> Token;
@@ -47,199 +303,2223 @@ namespace neroll {
         auto parse_literal(std::string_view literal, TokenType type) -> Token;
 
         auto parse_number() -> Token;
+        static auto to_double(std::uint64_t mantissa, int exponent, bool negative, double &value) -> bool;
         auto parse_string() -> Token;
+        auto parse_unicode_escape() -> ErrorCode;
+        auto read_hex4(const char *pos) const -> int;
 
         void parse_white();
 
+        // the token at json_, which is not whitespace
+        auto lex_here() -> Token;
+        auto lex_indexed_string(std::size_t start) -> Token;
+        // run stage 1 over the window from `offset`
+        void index_from(std::size_t offset);
+
         auto match(const char *ch, TokenType type) -> Token;
-        
 
+        // records the error, returns an ERROR token
+        auto fail(ErrorCode code, std::size_t offset, std::string_view text = {}) -> Token;
+
+        const char *begin_;
         const char *json_;
         const char *end_;   // end of json string
 
-        std::size_t lineno_{1}; // which line now?
-        std::size_t colno_{1};  // which column now?
+        bool indexed_{false};
+        StructuralIndex index_;
+        std::size_t next_structural_{0};
+
+        Location origin_{1, 1};
+        ParseError error_;
+
+        [[no_unique_address]] StatsStorage stats_;
     };
 
 
-    enum class AstType {
+    enum class AstType : std::uint8_t {
         OBJECT, ARRAY, STRING, INT, FLOAT, BOOLEAN, NIL
     };
 
-    class AstNode {
+    // The contents of a file, mapped into memory where mmap is available
+    // and read into a buffer otherwise. The contents are read-only and stay
+    // valid as long as the object lives.
+    class MappedFile {
      public:
-        // using value_type = std::variant<std::monostate, int64_t, double,
-        //     std::string, std::vector<std::shared_ptr<AstNode>>, bool,
-        //     std::map<std::string, std::shared_ptr<AstNode>>>;
+        // Throws std::runtime_error if the file can not be read. A file
+        // that is read front to back has its pages faulted in at once,
+        // otherwise they are only read when touched.
+        explicit MappedFile(const std::string &path, bool sequential = true);
+        ~MappedFile();
 
-        AstNode(AstType type) : type_(type) {}
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
 
-        AstType type() const {
-            return type_;
+        std::string_view data() const {
+            return data_;
         }
+
      private:
-        AstType type_;
+        std::string_view data_;
+        void *mapping_{nullptr};
+        std::string buffer_;    // the contents when the file is not mapped
+
+        bool map(int fd, std::size_t size, bool sequential);
+        void read(const std::string &path);
     };
 
-    class IntNode : public AstNode {
+    class AstNode;
+
+    // What to do when an object has the same key more than once.
+    enum class DuplicateKeys {
+        KEEP_ALL,   // keep every member, lookups find the first one
+        KEEP_FIRST,
+        KEEP_LAST,
+        ERROR,      // reject the document
+    };
+
+    struct ParseOptions {
+        static constexpr std::size_t INDEX_THRESHOLD = 64 * 1024;
+
+        DuplicateKeys duplicate_keys{DuplicateKeys::KEEP_ALL};
+        // containers nested deeper than this are an error, the root
+        // container is at depth 1
+        std::size_t max_depth{1024};
+        // inputs of at least this many bytes are indexed by stage 1 before
+        // they are parsed (Lexer::build_index), SIZE_MAX never indexes
+        std::size_t index_threshold{INDEX_THRESHOLD};
+    };
+
+    enum class BinaryFormat;
+
+    // A parsed json document. Every value lives in one contiguous tape of
+    // tagged 64-bit slots, the tag (AstType) is kept in the top 8 bits and
+    // the payload in the low 56 bits:
+    //
+    //   INT / FLOAT       [tag] [int64 or double bits]
+    //   STRING            [tag | flag | offset] [length]
+    //   BOOLEAN           [tag | 0 or 1]
+    //   NIL               [tag]
+    //   ARRAY / OBJECT    [tag | slots of the whole container] [element count]
+    //
+    // Strings without escape sequences point into the source text (the flag
+    // bit is set), the others are decoded into the document's own string
+    // buffer. The source text must therefore outlive the document.
+    //
+    // Object members are stored as a STRING key followed by the value. The
+    // slot count of a container is relative, so a subtree can be skipped in
+    // one step without touching its children. Destroying the document frees
+    // every node at once.
+    class Document {
      public:
-        IntNode(int64_t value) : AstNode(AstType::INT) {
-            value_ = value;
+        static constexpr int TAG_SHIFT = 56;
+        static constexpr std::uint64_t PAYLOAD_MASK = (std::uint64_t{1} << TAG_SHIFT) - 1;
+        static constexpr std::uint64_t SOURCE_STRING = std::uint64_t{1} << (TAG_SHIFT - 1);
+
+        // objects with at least this many members get a hash index the
+        // first time a key is looked up, smaller ones are scanned
+        static constexpr std::size_t HASH_INDEX_THRESHOLD = 32;
+
+        Document(std::string_view source = {});
+        ~Document();
+
+        Document(Document &&) noexcept;
+        Document &operator=(Document &&) noexcept;
+
+        // the root value, the document must outlive every node taken from it
+        AstNode root() const;
+
+        bool empty() const {
+            return tape_size() == 0;
         }
 
-        int64_t value() const {
-            return value_;
+        std::size_t tape_size() const {
+            return mapped_tape_ ? mapped_tape_size_ : tape_.size();
+        }
+
+        AstType type_at(std::size_t index) const {
+            return static_cast<AstType>(tape()[index] >> TAG_SHIFT);
+        }
+
+        std::uint64_t payload_at(std::size_t index) const {
+            return tape()[index] & PAYLOAD_MASK;
+        }
+
+        std::uint64_t slot_at(std::size_t index) const {
+            return tape()[index];
+        }
+
+        std::string_view string_at(std::size_t index) const {
+            auto payload = payload_at(index);
+            const char *base = (payload & SOURCE_STRING) ? source_.data() : strings().data();
+            return {base + (payload & ~SOURCE_STRING), tape()[index + 1]};
+        }
+
+        std::string_view source() const {
+            return source_;
+        }
+
+        // index of the value following the one at `index`
+        std::size_t next_index(std::size_t index) const;
+
+        // bytes held by the tape and the decoded strings
+        std::size_t memory_usage() const {
+            return tape_.capacity() * sizeof(std::uint64_t) + strings_.capacity();
         }
 
+        // Empty the document for a new parse of `source`. The tape and the
+        // string buffer keep their capacity.
+        void clear(std::string_view source = {});
+
+        // index of the first key equal to `key` in the object at `index`,
+        // or 0 if there is none
+        std::size_t find_key(std::size_t index, std::string_view key) const;
+
+        // A document over a tape and decoded strings that are kept
+        // elsewhere, like those of a StaticDocument. Both must outlive it,
+        // unless they lie in `file`, which the document keeps alive. Large
+        // objects get hash indexes as in a parsed document.
+        static auto view(std::span<const std::uint64_t> tape, std::string_view strings,
+            std::shared_ptr<const MappedFile> file = nullptr) -> Document;
+
      private:
-        int64_t value_;
+        friend class DocumentBuilder;
+        friend class ParallelParser;
+
+        struct KeyIndexes;  // hash indexes of large objects, built lazily
+
+        // done before the document is shared, like the builder does for
+        // large objects, so that concurrent lookups only share the mutex
+        void enable_key_indexes();
+
+        std::string_view source_;
+        std::vector<std::uint64_t> tape_;
+        std::string strings_;   // decoded strings and keys
+        mutable std::unique_ptr<KeyIndexes> key_indexes_;
+        std::shared_ptr<const MappedFile> file_;    // source of parse_file(), or a snapshot
+
+        // a loaded snapshot reads its tape and strings from file_ instead
+        const std::uint64_t *mapped_tape_{nullptr};
+        std::size_t mapped_tape_size_{0};
+        std::string_view mapped_strings_;
+
+        const std::uint64_t *tape() const {
+            return mapped_tape_ ? mapped_tape_ : tape_.data();
+        }
+
+        std::string_view strings() const {
+            return mapped_tape_ ? mapped_strings_ : std::string_view{strings_};
+        }
+
+        friend auto parse_file(const std::string &path, ParseOptions options) -> Document;
+        friend auto decode_binary(std::string_view data, BinaryFormat format, ParseOptions options) -> Document;
+        friend bool try_save_snapshot(const Document &document, const std::string &path, const std::string &source_path);
     };
 
-    class FloatNode : public AstNode {
+    // Snapshots are a document's tape and strings written to a file as they
+    // are in memory, behind a versioned header. Loading maps the file and
+    // reads the document from it in place, so nothing is parsed, copied or
+    // even read before it is used. The header records the size and
+    // modification time of the json file the document came from, and a
+    // checksum of the contents that verify_snapshot() checks. Snapshots
+    // are only read back on a machine with the same byte order.
+    inline constexpr std::uint32_t SNAPSHOT_VERSION = 1;
+
+    // Write `document` to `path` as a snapshot of the file `source_path`.
+    // Strings that point into the source are copied into the snapshot.
+    // The file is replaced atomically, also when several processes write
+    // it at once. Throws std::runtime_error on io errors.
+    void save_snapshot(const Document &document, const std::string &path, const std::string &source_path);
+
+    // The same without throwing, false if the snapshot could not be
+    // written. A half written file is removed.
+    bool try_save_snapshot(const Document &document, const std::string &path, const std::string &source_path);
+
+    // Throws std::runtime_error if `path` is not a snapshot of this
+    // version or its size does not match its header. Only the header is
+    // read, a file that may have been damaged or comes from elsewhere
+    // should pass verify_snapshot() first.
+    auto load_snapshot(const std::string &path) -> Document;
+
+    // Reads the whole snapshot at `path`: true if its checksum matches and
+    // its tape is well formed, with no container or string reaching outside
+    // of the tape or the strings.
+    bool verify_snapshot(const std::string &path);
+
+    // true if the snapshot at `path` was taken of `source_path` as it is now
+    bool snapshot_is_current(const std::string &path, const std::string &source_path);
+
+    // Load the snapshot of `source_path` at `snapshot_path` if it is
+    // current, checked like load_snapshot() does. Otherwise parse the json file and save a new
+    // snapshot for next time; the snapshot is only a cache, so if it can
+    // not be written the parsed document is returned all the same.
+    auto load_cached(const std::string &source_path, const std::string &snapshot_path,
+        ParseOptions options = {}) -> Document;
+
+    // Parse a file without copying it: strings without escape sequences
+    // point into the mapped file, which the document keeps alive. Throws
+    // std::runtime_error if the file can not be read or is not valid json.
+    auto parse_file(const std::string &path, ParseOptions options = {}) -> Document;
+
+    // Reports an error of parse_static(). It is not constexpr, so reaching
+    // it at compile time stops compilation, and the diagnostic shows the
+    // offset and the message. At run time it throws std::runtime_error.
+    [[noreturn]] void static_json_error(std::size_t offset, const char *message);
+
+    // A string literal as a template argument.
+    template <std::size_t N>
+    struct JsonLiteral {
+        char text[N];
+
+        consteval JsonLiteral(const char (&literal)[N]) {
+            for (std::size_t i = 0; i < N; i++)
+                text[i] = literal[i];
+        }
+
+        constexpr std::string_view view() const {
+            return {text, N - 1};
+        }
+    };
+
+    // A document built at compile time. The tape has the layout of
+    // Document, with every string decoded into `strings`.
+    template <std::size_t TapeSize, std::size_t StringsSize>
+    struct StaticDocument {
+        std::array<std::uint64_t, TapeSize> tape{};
+        std::array<char, StringsSize> strings{};
+
+        constexpr AstType type_at(std::size_t index) const {
+            return static_cast<AstType>(tape[index] >> Document::TAG_SHIFT);
+        }
+
+        constexpr std::uint64_t payload_at(std::size_t index) const {
+            return tape[index] & Document::PAYLOAD_MASK;
+        }
+
+        constexpr std::string_view string_at(std::size_t index) const {
+            return {strings.data() + payload_at(index), tape[index + 1]};
+        }
+
+        constexpr std::int64_t int_at(std::size_t index) const {
+            return std::bit_cast<std::int64_t>(tape[index + 1]);
+        }
+
+        constexpr double double_at(std::size_t index) const {
+            return std::bit_cast<double>(tape[index + 1]);
+        }
+
+        constexpr bool bool_at(std::size_t index) const {
+            return payload_at(index) != 0;
+        }
+
+        constexpr std::size_t next_index(std::size_t index) const {
+            switch (type_at(index)) {
+                case AstType::BOOLEAN:
+                case AstType::NIL:
+                    return index + 1;
+                case AstType::ARRAY:
+                case AstType::OBJECT:
+                    return index + payload_at(index);
+                default:
+                    return index + 2;
+            }
+        }
+
+        // index of the first key equal to `key` in the object at `index`,
+        // or 0 if there is none
+        constexpr std::size_t find_key(std::size_t index, std::string_view key) const {
+            for (auto i = index + 2; i < index + payload_at(index); i = next_index(i + 2)) {
+                if (string_at(i) == key)
+                    return i;
+            }
+            return 0;
+        }
+
+        // the same tape as a Document, for the AstNode api at run time
+        auto document() const -> Document {
+            return Document::view(tape, {strings.data(), strings.size()});
+        }
+    };
+
+    // The parser behind parse_static(), a recursive descent over the text
+    // that accepts exactly what Lexer and Parser accept. Without `tape` it
+    // only measures the tape and the strings. Floats must be exact with at
+    // most 2^53 as the mantissa and 10^22 as the power of ten, which is
+    // what the lexer's fast path converts; other floats are an error
+    // rather than a value rounded differently from the run time parser.
+    class StaticParser {
      public:
-        FloatNode(double value) : AstNode(AstType::FLOAT) {
-            value_ = value;
+        constexpr StaticParser(std::string_view json, std::uint64_t *tape = nullptr, char *strings = nullptr)
+            : json_(json), tape_(tape), strings_(strings) {}
+
+        constexpr void parse() {
+            skip_white();
+            parse_value(0);
+            skip_white();
+            if (pos_ != json_.size())
+                static_json_error(pos_, "unexpected character after the value");
         }
 
-        double value() const {
-            return value_;
+        constexpr std::size_t tape_size() const {
+            return tape_size_;
         }
+
+        constexpr std::size_t strings_size() const {
+            return strings_size_;
+        }
+
      private:
-        double value_;
+        std::string_view json_;
+        std::size_t pos_{0};
+        std::uint64_t *tape_;
+        char *strings_;
+        std::size_t tape_size_{0};
+        std::size_t strings_size_{0};
+
+        constexpr void append(std::uint64_t slot) {
+            if (tape_)
+                tape_[tape_size_] = slot;
+            tape_size_++;
+        }
+
+        constexpr void append(AstType type, std::uint64_t payload) {
+            append((static_cast<std::uint64_t>(type) << Document::TAG_SHIFT) | payload);
+        }
+
+        constexpr void append_char(char ch) {
+            if (strings_)
+                strings_[strings_size_] = ch;
+            strings_size_++;
+        }
+
+        constexpr bool at(char ch) const {
+            return pos_ < json_.size() && json_[pos_] == ch;
+        }
+
+        constexpr bool at_digit() const {
+            return pos_ < json_.size() && json_[pos_] >= '0' && json_[pos_] <= '9';
+        }
+
+        constexpr void skip_white() {
+            while (at(' ') || at('\t') || at('\n') || at('\r'))
+                pos_++;
+        }
+
+        constexpr void parse_value(std::size_t depth) {
+            if (pos_ == json_.size())
+                static_json_error(pos_, "unexpected end of input");
+            switch (json_[pos_]) {
+                case '{':
+                case '[':
+                    return parse_container(depth + 1);
+                case '\"':
+                    return parse_string();
+                case 't':
+                    return parse_literal("true", AstType::BOOLEAN, 1);
+                case 'f':
+                    return parse_literal("false", AstType::BOOLEAN, 0);
+                case 'n':
+                    return parse_literal("null", AstType::NIL, 0);
+                default:
+                    return parse_number();
+            }
+        }
+
+        constexpr void parse_container(std::size_t depth) {
+            if (depth > ParseOptions{}.max_depth)
+                static_json_error(pos_, "nesting is deeper than the maximum depth");
+            bool object = json_[pos_++] == '{';
+            char close = object ? '}' : ']';
+            auto index = tape_size_;
+            append(0);
+            append(0);
+            std::uint64_t count = 0;
+            skip_white();
+            if (at(close)) {
+                pos_++;
+            } else {
+                while (true) {
+                    if (object) {
+                        if (!at('\"'))
+                            static_json_error(pos_, "object key should be a string");
+                        parse_string();
+                        skip_white();
+                        if (!at(':'))
+                            static_json_error(pos_, "expect colon after key");
+                        pos_++;
+                        skip_white();
+                    }
+                    parse_value(depth);
+                    count++;
+                    skip_white();
+                    if (at(close)) {
+                        pos_++;
+                        break;
+                    }
+                    if (!at(','))
+                        static_json_error(pos_, object ? "missing comma or right brace when parsing object"
+                            : "missing comma or right bracket when parsing array");
+                    pos_++;
+                    skip_white();
+                }
+            }
+            if (tape_) {
+                auto type = object ? AstType::OBJECT : AstType::ARRAY;
+                tape_[index] = (static_cast<std::uint64_t>(type) << Document::TAG_SHIFT) | (tape_size_ - index);
+                tape_[index + 1] = count;
+            }
+        }
+
+        constexpr void parse_literal(std::string_view word, AstType type, std::uint64_t payload) {
+            if (json_.substr(pos_, word.size()) != word)
+                static_json_error(pos_, "invalid literal");
+            pos_ += word.size();
+            append(type, payload);
+        }
+
+        constexpr void parse_string() {
+            auto begin = strings_size_;
+            pos_++;
+            while (!at('\"')) {
+                if (pos_ == json_.size())
+                    static_json_error(pos_, "unterminated string");
+                auto ch = static_cast<unsigned char>(json_[pos_++]);
+                if (ch < 0x20)
+                    static_json_error(pos_ - 1, "control character in string");
+                if (ch != '\\') {
+                    append_char(static_cast<char>(ch));
+                    continue;
+                }
+                if (pos_ == json_.size())
+                    static_json_error(pos_, "unterminated string");
+                switch (json_[pos_++]) {
+                    case '\"': append_char('\"'); break;
+                    case '\\': append_char('\\'); break;
+                    case '/': append_char('/'); break;
+                    case 'b': append_char('\b'); break;
+                    case 'f': append_char('\f'); break;
+                    case 'n': append_char('\n'); break;
+                    case 'r': append_char('\r'); break;
+                    case 't': append_char('\t'); break;
+                    case 'u': parse_unicode_escape(); break;
+                    default:
+                        static_json_error(pos_ - 1, "invalid escape sequence");
+                }
+            }
+            pos_++;
+            append(AstType::STRING, begin);
+            append(strings_size_ - begin);
+        }
+
+        constexpr std::uint32_t read_hex4() {
+            std::uint32_t code = 0;
+            for (int i = 0; i < 4; i++, pos_++) {
+                if (pos_ == json_.size())
+                    static_json_error(pos_, "invalid unicode escape, expect 4 hex digits");
+                char ch = json_[pos_];
+                std::uint32_t digit = ch >= '0' && ch <= '9' ? ch - '0'
+                    : ch >= 'a' && ch <= 'f' ? ch - 'a' + 10
+                    : ch >= 'A' && ch <= 'F' ? ch - 'A' + 10 : 16;
+                if (digit == 16)
+                    static_json_error(pos_, "invalid unicode escape, expect 4 hex digits");
+                code = code * 16 + digit;
+            }
+            return code;
+        }
+
+        // pos_ is after the u of \uXXXX
+        constexpr void parse_unicode_escape() {
+            auto code = read_hex4();
+            if (code >= 0xDC00 && code <= 0xDFFF)
+                static_json_error(pos_, "unpaired low surrogate in unicode escape");
+            if (code >= 0xD800 && code <= 0xDBFF) {
+                if (json_.substr(pos_, 2) != "\\u")
+                    static_json_error(pos_, "unpaired high surrogate in unicode escape");
+                pos_ += 2;
+                auto low = read_hex4();
+                if (low < 0xDC00 || low > 0xDFFF)
+                    static_json_error(pos_, "unpaired high surrogate in unicode escape");
+                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+            }
+            if (code < 0x80) {
+                append_char(static_cast<char>(code));
+            } else if (code < 0x800) {
+                append_char(static_cast<char>(0xC0 | (code >> 6)));
+                append_char(static_cast<char>(0x80 | (code & 0x3F)));
+            } else if (code < 0x10000) {
+                append_char(static_cast<char>(0xE0 | (code >> 12)));
+                append_char(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+                append_char(static_cast<char>(0x80 | (code & 0x3F)));
+            } else {
+                append_char(static_cast<char>(0xF0 | (code >> 18)));
+                append_char(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+                append_char(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+                append_char(static_cast<char>(0x80 | (code & 0x3F)));
+            }
+        }
+
+        constexpr void parse_number() {
+            auto begin = pos_;
+            bool negative = at('-');
+            if (negative)
+                pos_++;
+            if (!at_digit())
+                static_json_error(begin, "invalid token");
+            if (at('0') && (pos_++, at_digit()))
+                static_json_error(begin, "invalid number, leading zeros are not allowed");
+
+            // every significant digit is kept, the mantissa must not overflow
+            std::uint64_t mantissa = 0;
+            bool overflow = false;
+            int exponent = 0;
+            auto add_digit = [&] {
+                std::uint64_t digit = json_[pos_++] - '0';
+                if (mantissa > (UINT64_MAX - digit) / 10)
+                    overflow = true;
+                mantissa = mantissa * 10 + digit;
+            };
+            while (at_digit())
+                add_digit();
+            bool is_float = false;
+            if (at('.')) {
+                is_float = true;
+                pos_++;
+                if (!at_digit())
+                    static_json_error(pos_, "invalid number");
+                for (; at_digit(); exponent--)
+                    add_digit();
+            }
+            if (at('e') || at('E')) {
+                is_float = true;
+                pos_++;
+                bool negative_exponent = at('-');
+                if (at('+') || at('-'))
+                    pos_++;
+                if (!at_digit())
+                    static_json_error(pos_, "invalid number");
+                int explicit_exponent = 0;
+                for (; at_digit(); pos_++) {
+                    if (explicit_exponent < 100000)
+                        explicit_exponent = explicit_exponent * 10 + (json_[pos_] - '0');
+                }
+                exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
+            }
+
+            if (!is_float) {
+                std::uint64_t limit = static_cast<std::uint64_t>(INT64_MAX) + (negative ? 1 : 0);
+                if (overflow || mantissa > limit)
+                    static_json_error(begin, "number out of range");
+                append(AstType::INT, 0);
+                append(negative ? 0 - mantissa : mantissa);
+                return;
+            }
+
+            // IEEE multiplication and division round correctly, so with an
+            // exact mantissa and power of ten the result is exact too
+            constexpr double POWERS[] = {
+                1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+            };
+            if (mantissa == 0) {
+                exponent = 0;
+            } else {
+                // trailing zeros move to the exponent, as in 1.50 or 1200e-3
+                for (; mantissa % 10 == 0 && !overflow; mantissa /= 10)
+                    exponent++;
+            }
+            if (overflow || mantissa > (std::uint64_t{1} << 53) || exponent < -22 || exponent > 22)
+                static_json_error(begin, "float can not be converted exactly at compile time");
+            double value = static_cast<double>(mantissa);
+            value = exponent < 0 ? value / POWERS[-exponent] : value * POWERS[exponent];
+            append(AstType::FLOAT, 0);
+            append(std::bit_cast<std::uint64_t>(negative ? -value : value));
+        }
     };
 
-    class ArrayNode : public AstNode {
+    // Parse a json literal while compiling:
+    //
+    //     constexpr auto config = neroll::parse_static<R"({"size": 4})">();
+    //
+    // The tape and strings are sized to fit exactly. Invalid json does not
+    // compile, see static_json_error().
+    template <JsonLiteral json>
+    consteval auto parse_static() {
+        constexpr auto sizes = [] {
+            StaticParser parser(json.view());
+            parser.parse();
+            return std::pair{parser.tape_size(), parser.strings_size()};
+        }();
+        StaticDocument<sizes.first, sizes.second> document;
+        StaticParser(json.view(), document.tape.data(), document.strings.data()).parse();
+        return document;
+    }
+
+    // The events a parser reports, in document order. Members of an object
+    // are reported as on_key() followed by the value. If on_key() returns
+    // bool, false rejects the key as a duplicate and the parser throws.
+    // Strings are only valid during the call.
+    template <typename T>
+    concept Handler = requires(T handler, std::string_view text) {
+        handler.on_start_object();
+        handler.on_end_object();
+        handler.on_start_array();
+        handler.on_end_array();
+        handler.on_key(text);
+        handler.on_string(text);
+        handler.on_int(std::int64_t{});
+        handler.on_double(double{});
+        handler.on_bool(bool{});
+        handler.on_null();
+    };
+
+    // The handler that builds a Document: appends values in parse order.
+    // Strings that lie inside the document's source are referenced, all
+    // others are copied.
+    class DocumentBuilder {
      public:
-        ArrayNode() : AstNode(AstType::ARRAY) {}
+        DocumentBuilder(Document &document, DuplicateKeys duplicate_keys = DuplicateKeys::KEEP_ALL)
+            : document_(document), duplicate_keys_(duplicate_keys) {}
 
-        void push_back(const std::shared_ptr<AstNode> node) {
-            value_.push_back(node);
+        void on_start_object();
+        void on_end_object();
+        void on_start_array();
+        void on_end_array();
+
+        // returns false if the key repeats and duplicates are an error
+        bool on_key(std::string_view key);
+        void on_string(std::string_view value);
+        void on_int(int64_t value);
+        void on_double(double value);
+        void on_bool(bool value);
+        void on_null();
+
+        // forget a parse that ended with an error, keeping the capacity of
+        // the buffers
+        void reset();
+
+        // bytes held by the buffers, without the document
+        std::size_t memory_usage() const {
+            return open_.capacity() * sizeof(Container) + (keys_.capacity() + dead_.capacity()) * sizeof(std::size_t);
         }
 
-        std::size_t size() const {
-            return value_.size();
+     private:
+        struct Container {
+            std::size_t index;      // header slot on the tape
+            std::size_t count;      // number of elements or members
+            std::size_t keys_begin; // first key of this object in keys_
+            std::size_t dead_begin; // first replaced member in dead_
+            // key hash to key slot, only for large objects
+            std::unique_ptr<std::unordered_multimap<std::size_t, std::size_t>> key_hashes;
+        };
+
+        // the member being parsed repeats a key under KEEP_FIRST and is
+        // dropped once complete
+        struct Discard {
+            std::size_t depth;
+            std::size_t tape_size;
+            std::size_t strings_size;
+        };
+
+        Document &document_;
+        DuplicateKeys duplicate_keys_;
+        std::vector<Container> open_;
+        std::vector<std::size_t> keys_; // key slots of the open objects
+        std::vector<std::size_t> dead_; // members replaced under KEEP_LAST
+        std::optional<Discard> discard_;
+
+        void append(AstType type, std::uint64_t payload);
+        void append_string(std::string_view value);
+        void finish_value();
+        void start_container(AstType type);
+        void end_container();
+
+        auto find_open_key(Container &object, std::string_view key) -> std::size_t *;
+        void remember_key(Container &object, std::size_t slot, std::size_t hash);
+        void remove_dead_members(Container &object);
+    };
+
+    // A lightweight view of one value in a Document.
+    class AstNode {
+     public:
+        AstNode(const Document *document, std::size_t index)
+            : document_(document), index_(index) {}
+
+        AstType type() const {
+            return document_->type_at(index_);
         }
 
-        std::shared_ptr<AstNode> &operator[](std::size_t index);
+        std::size_t index() const {
+            return index_;
+        }
 
-        std::vector<std::shared_ptr<AstNode>> &value() {
-            return value_;
+        const Document &document() const {
+            return *document_;
         }
 
-     private:
-        std::vector<std::shared_ptr<AstNode>> value_;
+     protected:
+        const Document *document_;
+        std::size_t index_;
     };
 
-    class ObjectNode : public AstNode {
+    class IntNode : public AstNode {
      public:
+        explicit IntNode(AstNode node) : AstNode(node) {}
+
+        int64_t value() const {
+            return std::bit_cast<int64_t>(document_->slot_at(index_ + 1));
+        }
+    };
 
-        ObjectNode() : AstNode(AstType::OBJECT) {}
+    class FloatNode : public AstNode {
+     public:
+        explicit FloatNode(AstNode node) : AstNode(node) {}
 
-        void insert(std::pair<std::string, std::shared_ptr<AstNode>> item) {
-            value_.insert(item);
+        double value() const {
+            return std::bit_cast<double>(document_->slot_at(index_ + 1));
         }
+    };
+
+    class ArrayNode : public AstNode {
+     public:
+        class iterator {
+         public:
+            using value_type = AstNode;
+            using difference_type = std::ptrdiff_t;
+
+            iterator() = default;
+            iterator(const Document *document, std::size_t index)
+                : document_(document), index_(index) {}
+
+            AstNode operator*() const {
+                return {document_, index_};
+            }
+
+            iterator &operator++() {
+                index_ = document_->next_index(index_);
+                return *this;
+            }
+
+            iterator operator++(int) {
+                auto old = *this;
+                ++*this;
+                return old;
+            }
+
+            bool operator==(const iterator &other) const {
+                return index_ == other.index_;
+            }
+
+         private:
+            const Document *document_{nullptr};
+            std::size_t index_{0};
+        };
+
+        explicit ArrayNode(AstNode node) : AstNode(node) {}
 
         std::size_t size() const {
-            return value_.size();
+            return document_->slot_at(index_ + 1);
         }
 
-        std::shared_ptr<AstNode> &at(std::string key) {
-            return value_.at(key);
+        // elements are not indexed, this walks the array from the front
+        AstNode operator[](std::size_t index) const;
+
+        iterator begin() const {
+            return {document_, index_ + 2};
         }
 
-     private:
-        std::map<std::string, std::shared_ptr<AstNode>> value_;
+        iterator end() const {
+            return {document_, index_ + document_->payload_at(index_)};
+        }
+    };
 
+    class ObjectNode : public AstNode {
      public:
-        using value_type = decltype(value_);
-    
-        value_type &value() {
-            return value_;
+        class iterator {
+         public:
+            using value_type = std::pair<std::string_view, AstNode>;
+            using difference_type = std::ptrdiff_t;
+
+            iterator() = default;
+            iterator(const Document *document, std::size_t index)
+                : document_(document), index_(index) {}
+
+            value_type operator*() const {
+                return {document_->string_at(index_), AstNode{document_, index_ + 2}};
+            }
+
+            iterator &operator++() {
+                index_ = document_->next_index(index_ + 2);
+                return *this;
+            }
+
+            iterator operator++(int) {
+                auto old = *this;
+                ++*this;
+                return old;
+            }
+
+            bool operator==(const iterator &other) const {
+                return index_ == other.index_;
+            }
+
+         private:
+            const Document *document_{nullptr};
+            std::size_t index_{0};
+        };
+
+        explicit ObjectNode(AstNode node) : AstNode(node) {}
+
+        std::size_t size() const {
+            return document_->slot_at(index_ + 1);
+        }
+
+        // throws std::out_of_range if the key does not exist
+        AstNode at(std::string_view key) const;
+
+        // end() if the key does not exist
+        iterator find(std::string_view key) const;
+
+        bool contains(std::string_view key) const {
+            return document_->find_key(index_, key) != 0;
+        }
+
+        iterator begin() const {
+            return {document_, index_ + 2};
+        }
+
+        iterator end() const {
+            return {document_, index_ + document_->payload_at(index_)};
         }
-    
     };
 
     class BooleanNode : public AstNode {
      public:
-        BooleanNode(bool value) : AstNode(AstType::BOOLEAN) {
-            value_ = value;
-        }
+        explicit BooleanNode(AstNode node) : AstNode(node) {}
 
         bool value() const {
-            return value_;
+            return document_->payload_at(index_) != 0;
         }
-     private:
-        bool value_;
     };
 
     class StringNode : public AstNode {
      public:
-        StringNode(std::string_view value) : AstNode(AstType::STRING) {
-            value_ = value;
-        }
+        explicit StringNode(AstNode node) : AstNode(node) {}
 
-        std::string value() const {
-            return value_;
+        std::string_view value() const {
+            return document_->string_at(index_);
         }
-     private:
-        std::string value_;
     };
 
     class NullNode : public AstNode {
      public:
-        NullNode() : AstNode(AstType::NIL) {}
+        explicit NullNode(AstNode node) : AstNode(node) {}
     };
 
+    inline AstNode Document::root() const {
+        return {this, 0};
+    }
 
-    class Parser {
+
+    // A document or the error that stopped its parse, with the interface of
+    // std::expected<Document, ParseError>, which needs C++23.
+    class ParseResult {
      public:
-        Parser(Lexer lexer) : lexer_(lexer) {
-            move();
+        ParseResult(Document document) : document_(std::move(document)) {}
+        ParseResult(const ParseError &error) : error_(error) {}
+
+        bool has_value() const {
+            return !error_;
         }
-        
-        auto parse() -> std::shared_ptr<AstNode>;
-    
-     private:
-        Lexer lexer_;
-        Token current_token_;
 
-        // match literal, including true, false, null, string and number
-        auto match(const Token &token) -> std::shared_ptr<AstNode>;
+        explicit operator bool() const {
+            return has_value();
+        }
 
-        void throw_error(std::string_view message, const Token &token);
-        
-        void move() {
-            current_token_ = lexer_.next_token();
+        Document &value() & {
+            return document_;
         }
 
-        void expect(TokenType expect_type);
+        const Document &value() const & {
+            return document_;
+        }
 
-        auto parse_array() -> std::shared_ptr<AstNode>;
-        auto parse_object() -> std::shared_ptr<AstNode>;
-    };
+        Document &&value() && {
+            return std::move(document_);
+        }
 
-    class Stringifier {
+        Document &operator*() & {
+            return document_;
+        }
+
+        const Document &operator*() const & {
+            return document_;
+        }
+
+        Document *operator->() {
+            return &document_;
+        }
+
+        const Document *operator->() const {
+            return &document_;
+        }
+
+        const ParseError &error() const {
+            return error_;
+        }
+
+     private:
+        Document document_;
+        ParseError error_;
+    };
+
+    // Errors are recorded in error() and handed up as false, nothing below
+    // the public throwing functions throws. Those wrap the try_ functions
+    // and throw std::runtime_error with error().message().
+    class Parser {
      public:
-        Stringifier(const std::shared_ptr<AstNode> &ast) : json_ast_(ast) {
-            load_config();
+        Parser(Lexer lexer, ParseOptions options = {})
+            : lexer_(std::move(lexer)), options_(options) {
+            index_input();
+            move();
         }
+        
+        auto parse() -> Document;
+
+        auto try_parse() -> ParseResult;
 
-        std::string to_html() const;
+        // parse `json` next, keeping the capacity of the buffers; errors
+        // are located as if `json` started at `origin`
+        void reset(std::string_view json, Location origin = {1, 1}) {
+            lexer_.reset(json);
+            lexer_.set_origin(origin);
+            stack_.clear();
+            index_input();
+            move();
+        }
+
+        // bytes held by the buffers of the parser and its lexer
+        std::size_t memory_usage() const {
+            return lexer_.memory_usage() + stack_.capacity() * sizeof(TokenType) + unescaped_.capacity();
+        }
+
+        // report the value to `handler` instead of building a document,
+        // duplicate_keys is left to the handler
+        template <Handler H>
+        void parse(H &handler) {
+            if (!try_parse(handler))
+                throw_error();
+        }
+
+        template <Handler H>
+        bool try_parse(H &handler) {
+            stack_.clear();
+            bool ok = false;
+            timed_build([&] {
+                ok = parse_value(handler);
+            });
+            return ok;
+        }
+
+        // Report the elements of an array, or the members of an object,
+        // whose brackets lie outside of the input: the text between two
+        // commas of a container. Stops at the end of the input. Returns
+        // false if the input is invalid.
+        template <Handler H>
+        bool try_parse_elements(H &handler);
+
+        template <Handler H>
+        bool try_parse_members(H &handler);
+
+        // throws unless only whitespace follows the parsed value
+        void expect_end() {
+            if (!try_expect_end())
+                throw_error();
+        }
+
+        bool try_expect_end() {
+            move();
+            return current_token_.type == TokenType::END || fail(ErrorCode::TRAILING_CONTENT, current_token_);
+        }
+
+        // why the last try_ function returned false
+        auto error() const -> const ParseError & {
+            return error_;
+        }
+
+        // the parser's stats and those of its lexer, all zero without
+        // NJSON_STATS
+        auto stats() const -> Stats;
     
      private:
-        std::shared_ptr<AstNode> json_ast_;
-        std::shared_ptr<AstNode> config_ast_;
+        Lexer lexer_;
+        ParseOptions options_;
+        Token current_token_;
+        std::string unescaped_; // reused for strings with escape sequences
+        std::vector<TokenType> stack_;  // LBRACE or LBRACKET of every open container
+        ParseError error_;
+        [[no_unique_address]] StatsStorage stats_;
+
+        template <Handler H>
+        bool parse_value(H &handler);
+
+        // a key and its colon, moves to the value
+        template <Handler H>
+        bool parse_key(H &handler);
+
+        // false if the container would be nested too deep
+        bool push_container(TokenType type);
+
+        // runs `parse` and adds its time, less the lexing, to build_time
+        template <typename F>
+        void timed_build(F &&parse);
+
+        // match literal, including true, false, null, string and number
+        template <Handler H>
+        bool match(const Token &token, H &handler);
+
+        // Records an error at `token` and returns false. An ERROR token
+        // keeps the lexer's error instead.
+        bool fail(ErrorCode code, const Token &token);
+
+        [[noreturn]] void throw_error() const;
+
+        // Runs stage 1 if the input is large enough. A lexer that does not
+        // start at the beginning is parsing a piece of its input, like a
+        // query match or a chunk of ParallelParser, and indexing all of it
+        // would cost more than it saves.
+        void index_input() {
+            if (lexer_.offset() == 0 && !lexer_.indexed() && lexer_.source().size() >= options_.index_threshold)
+                lexer_.build_index();
+        }
+        
+        void move() {
+            // tokens are taken from the index directly, unless each of
+            // them is timed for the stats
+            if (!STATS_ENABLED && lexer_.indexed())
+                current_token_ = lexer_.next_indexed_token();
+            else
+                current_token_ = lexer_.try_next_token();
+        }
+    };
+
+    template <typename F>
+    void Parser::timed_build(F &&parse) {
+        if constexpr (!STATS_ENABLED) {
+            parse();
+        } else {
+            auto lex_time = lexer_.stats().lex_time;
+            auto start = std::chrono::steady_clock::now();
+            parse();
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            with_stats(stats_, [&](auto &stats) {
+                stats.build_time += elapsed - (lexer_.stats().lex_time - lex_time);
+            });
+        }
+    }
+
+    // Containers are tracked on stack_ rather than the call stack, so deep
+    // nesting costs memory instead of overflowing the stack and is bounded
+    // by max_depth.
+    template <Handler H>
+    bool Parser::parse_value(H &handler) {
+        const auto base = stack_.size();
+        while (true) {
+            with_stats(stats_, [](auto &stats) {
+                stats.nodes++;
+            });
+            switch (current_token_.type) {
+                case TokenType::LBRACE:
+                    if (!push_container(TokenType::LBRACE))
+                        return false;
+                    move();
+                    handler.on_start_object();
+                    if (current_token_.type != TokenType::RBRACE) {
+                        if (!parse_key(handler))
+                            return false;
+                        continue;
+                    }
+                    stack_.pop_back();
+                    handler.on_end_object();
+                    break;
+                case TokenType::LBRACKET:
+                    if (!push_container(TokenType::LBRACKET))
+                        return false;
+                    move();
+                    handler.on_start_array();
+                    if (current_token_.type != TokenType::RBRACKET)
+                        continue;
+                    stack_.pop_back();
+                    handler.on_end_array();
+                    break;
+                case TokenType::STRING:
+                case TokenType::NUMBER:
+                case TokenType::TRUE:
+                case TokenType::FALSE:
+                case TokenType::NIL:
+                    if (!match(current_token_, handler))
+                        return false;
+                    break;
+                default:
+                    return fail(ErrorCode::INVALID_VALUE, current_token_);
+            }
+
+            // a value is complete, close the containers that end after it
+            while (true) {
+                if (stack_.size() == base)
+                    return true;
+                move();
+                bool in_array = stack_.back() == TokenType::LBRACKET;
+                if (current_token_.type == TokenType::COMMA) {
+                    move();
+                    if (!in_array && !parse_key(handler))
+                        return false;
+                    break;
+                }
+                if (in_array && current_token_.type == TokenType::RBRACKET) {
+                    stack_.pop_back();
+                    handler.on_end_array();
+                } else if (!in_array && current_token_.type == TokenType::RBRACE) {
+                    stack_.pop_back();
+                    handler.on_end_object();
+                } else if (in_array) {
+                    return fail(ErrorCode::MISSING_COMMA_IN_ARRAY, current_token_);
+                } else {
+                    return fail(ErrorCode::MISSING_COMMA_IN_OBJECT, current_token_);
+                }
+            }
+        }
+    }
+
+    template <Handler H>
+    bool Parser::parse_key(H &handler) {
+        if (current_token_.type != TokenType::STRING)
+            return fail(ErrorCode::KEY_NOT_STRING, current_token_);
+        auto key = string_value(current_token_, unescaped_);
+        if constexpr (std::is_same_v<decltype(handler.on_key(key)), bool>) {
+            if (!handler.on_key(key))
+                return fail(ErrorCode::DUPLICATE_KEY, current_token_);
+        } else {
+            handler.on_key(key);
+        }
+        move();
+        if (current_token_.type != TokenType::COLON)
+            return fail(ErrorCode::MISSING_COLON, current_token_);
+        move();
+        return true;
+    }
+
+    template <Handler H>
+    bool Parser::match(const Token &token, H &handler) {
+        switch (token.type) {
+            case TokenType::TRUE:
+                handler.on_bool(true);
+                return true;
+            case TokenType::FALSE:
+                handler.on_bool(false);
+                return true;
+            case TokenType::NIL:
+                handler.on_null();
+                return true;
+            case TokenType::STRING:
+                handler.on_string(string_value(token, unescaped_));
+                return true;
+            case TokenType::NUMBER:
+                if (token.is_float)
+                    handler.on_double(token.floating);
+                else
+                    handler.on_int(token.integer);
+                return true;
+            default:
+                return fail(ErrorCode::INVALID_VALUE, token);
+        }
+    }
+
+    // the unseen bracket counts towards the depth of the values
+    template <Handler H>
+    bool Parser::try_parse_elements(H &handler) {
+        stack_.assign(1, TokenType::LBRACKET);
+        while (true) {
+            if (!parse_value(handler))
+                return false;
+            move();
+
+            if (current_token_.type == TokenType::END) {
+                stack_.clear();
+                return true;
+            }
+            if (current_token_.type != TokenType::COMMA)
+                return fail(ErrorCode::MISSING_COMMA_IN_ARRAY, current_token_);
+            move();
+        }
+    }
+
+    template <Handler H>
+    bool Parser::try_parse_members(H &handler) {
+        stack_.assign(1, TokenType::LBRACE);
+        while (true) {
+            if (!parse_key(handler) || !parse_value(handler))
+                return false;
+
+            move();
+            if (current_token_.type == TokenType::END) {
+                stack_.clear();
+                return true;
+            }
+            if (current_token_.type != TokenType::COMMA)
+                return fail(ErrorCode::MISSING_COMMA_IN_OBJECT, current_token_);
+            move();
+        }
+    }
+
+    // Parse `json` without throwing, strings of the document point into it.
+    inline auto try_parse(std::string_view json, ParseOptions options = {}) -> ParseResult {
+        return Parser(Lexer{json}, options).try_parse();
+    }
+
+    // A parser and a document for many small inputs in a row, such as one
+    // message after another. Each parse reuses the tape, the strings, the
+    // container stack and the builder's key buffers of the ones before,
+    // so once they have grown to fit the inputs a parse allocates nothing.
+    // The document is only valid until the next parse, and its strings may
+    // point into the input.
+    class ReusableParser {
+     public:
+        ReusableParser(ParseOptions options = {});
+
+        ReusableParser(const ReusableParser &) = delete;
+        ReusableParser &operator=(const ReusableParser &) = delete;
+
+        // throws std::runtime_error if `json` is not valid json
+        auto parse(std::string_view json) -> const Document &;
+
+        // nullptr if `json` is not valid json, error() tells why; errors
+        // are located as if `json` started at `origin`
+        auto try_parse(std::string_view json, Location origin = {1, 1}) -> const Document *;
+
+        // false if more than whitespace follows the parsed value
+        bool try_expect_end() {
+            return parser_.try_expect_end();
+        }
+
+        auto error() const -> const ParseError & {
+            return parser_.error();
+        }
+
+        // Hand over the parsed document, to keep it past the next parse.
+        // The next parse grows a new tape and string buffer, the other
+        // buffers are still reused.
+        auto release() -> Document {
+            auto document = std::move(document_);
+            document_ = Document{};
+            return document;
+        }
+
+        // bytes held by the document and the buffers now
+        std::size_t memory_usage() const {
+            return document_.memory_usage() + builder_->memory_usage() + parser_.memory_usage();
+        }
+
+        // the largest memory_usage() after a parse since construction or
+        // the last trim()
+        std::size_t high_water_mark() const {
+            return high_water_mark_;
+        }
+
+        // Free every buffer if more than `limit` bytes are held, the next
+        // parse starts from empty ones. Also drops the current document.
+        void trim(std::size_t limit = 0);
+
+     private:
+        ParseOptions options_;
+        Document document_;
+        std::optional<DocumentBuilder> builder_;    // refers to document_
+        Parser parser_;
+        std::size_t high_water_mark_{0};
+    };
+
+    // A push parser for input that arrives in pieces. Feed it chunks of any
+    // size, a token split across chunks is buffered until it is complete.
+    // The input is a sequence of json values separated by optional
+    // whitespace, each one becomes a Document as soon as it is closed.
+    // Strings are copied into the documents, so chunks need not outlive the
+    // call to feed().
+    class StreamParser {
+     public:
+        StreamParser(ParseOptions options = {})
+            : options_(options), builder_(current_, options.duplicate_keys) {}
+
+        // throws std::runtime_error on invalid input, the parser can not be
+        // used any more after that
+        void feed(std::string_view chunk);
+
+        // end of input, completes a trailing number or literal and reports
+        // an unfinished value
+        void finish();
+
+        bool has_document() const {
+            return !ready_.empty();
+        }
+
+        // the oldest complete document
+        auto take_document() -> Document;
+
+     private:
+        enum class State {
+            VALUE,          // any value
+            ARRAY_FIRST,    // a value or ]
+            OBJECT_FIRST,   // a key or }
+            OBJECT_KEY,     // a key after a comma
+            COLON,          // : after a key
+            AFTER_VALUE,    // , or the end of the open container
+        };
+
+        // what the buffered partial token is
+        enum class Pending {
+            NONE, STRING, BARE,
+        };
+
+        ParseOptions options_;
+        Document current_;
+        DocumentBuilder builder_;
+        std::deque<Document> ready_;
+
+        State state_{State::VALUE};
+        std::vector<TokenType> open_;   // LBRACE or LBRACKET of every open container
+
+        Pending pending_kind_{Pending::NONE};
+        std::string pending_;           // bytes of a token split across chunks
+        std::size_t pending_offset_{0};
+        bool pending_escape_{false};    // pending string ends in an unfinished escape
+
+        std::size_t offset_{0};         // absolute offset of the current chunk
+        std::size_t line_{1};
+        std::size_t line_start_{0};     // absolute offset of the current line
+        std::string unescaped_; // reused for strings with escape sequences
+
+        auto continue_string(std::string_view chunk) -> std::size_t;
+        auto continue_bare(std::string_view chunk) -> std::size_t;
+
+        void lex(std::string_view text, std::size_t offset);
+        void handle(const Token &token);
+        void value(const Token &token);
+        void after_value();
+        void push_container(const Token &token);
+
+        [[noreturn]] void throw_error(std::string_view message, std::size_t offset) const;
+    };
+
+    class LazyDocument;
+
+    // A position in a LazyDocument. Nothing is parsed until a value is
+    // asked for, and subtrees that are passed over on the way to it are
+    // skipped by bracket matching, so they are not validated either. Every
+    // lookup scans from the start of its container.
+    class LazyValue {
+     public:
+        LazyValue(LazyDocument *document, std::size_t offset)
+            : document_(document), offset_(offset) {}
+
+        AstType type() const;
+
+        // throws std::out_of_range if the key or index does not exist
+        LazyValue operator[](std::string_view key) const;
+        LazyValue operator[](std::size_t index) const;
+
+        auto find(std::string_view key) const -> std::optional<LazyValue>;
+
+        // throw std::runtime_error if the value has a different type
+        int64_t get_int64() const;
+        double get_double() const;  // integers are converted
+        bool get_bool() const;
+        std::string_view get_string() const;
+        bool is_null() const;
+
+        // the text of the value in the input
+        std::string_view raw() const;
+
+        std::size_t offset() const {
+            return offset_;
+        }
+
+     private:
+        LazyDocument *document_;
+        std::size_t offset_;    // first byte of the value
+
+        auto scalar() const -> Token;
+        [[noreturn]] void throw_type_error(const Token &token, std::string_view expected) const;
+    };
+
+    // On-demand access to a json text: doc["user"]["id"].get_int64() reads
+    // only the bytes on the way to the value. The text must outlive the
+    // document and every value taken from it.
+    class LazyDocument {
+     public:
+        LazyDocument(std::string_view json) : json_(json) {}
+
+        LazyValue root();
+
+        LazyValue operator[](std::string_view key) {
+            return root()[key];
+        }
+
+        LazyValue operator[](std::size_t index) {
+            return root()[index];
+        }
+
+     private:
+        friend class LazyValue;
+
+        std::string_view json_;
+        std::deque<std::string> decoded_;   // strings with escape sequences
+
+        auto lexer_at(std::size_t offset) const -> Lexer;
+    };
+
+    // A compiled path that selects values straight from the json text.
+    // Accepts an RFC 6901 JSON Pointer ("/items/0/price", "" for the root)
+    // or a JSONPath subset ("$.items[0].price", "$['a b']"). In both, a "*"
+    // step matches every member or element. Subtrees off the path are
+    // skipped without building nodes, only matched values become
+    // documents. A Query can be reused for any number of inputs.
+    class Query {
+     public:
+        // throws std::runtime_error if `path` is not a valid query
+        explicit Query(std::string_view path);
+
+        // the matched values in document order, each as its own Document
+        // that references `json`
+        auto select(std::string_view json) const -> std::vector<Document>;
+
+     private:
+        struct Step {
+            enum class Kind {
+                KEY,
+                INDEX,
+                KEY_OR_INDEX,   // a pointer step of digits
+                ANY,
+            };
+            Kind kind;
+            std::string key;
+            std::size_t index{0};
+        };
+
+        std::vector<Step> steps_;
+
+        void compile_pointer(std::string_view path);
+        void compile_json_path(std::string_view path);
+
+        void select(Lexer &lexer, const Token &first, std::size_t depth,
+            std::string &scratch, std::vector<Document> &matches) const;
+    };
+
+    // One record of a json lines input.
+    struct Record {
+        std::size_t index{0};   // position among the records, blank lines are not counted
+        std::size_t line{0};    // line in the input, starting from 1
+        Document document;      // empty if the record is malformed
+        std::string error;      // why the record is malformed
+    };
+
+    // Parses newline-delimited json (NDJSON, JSON Lines) on several threads.
+    // The input is split at newlines once, then workers take batches of
+    // records and parse each one into its own Document. Each worker keeps
+    // one ReusableParser, whose buffers serve every record it takes. A
+    // malformed record only fails itself, its error names the line it is
+    // on. Documents reference the input, which must outlive them.
+    class LinesParser {
+     public:
+        // 0 threads means one per hardware thread
+        LinesParser(ParseOptions options = {}, unsigned threads = 0);
+
+        // every record in input order
+        auto parse(std::string_view input) const -> std::vector<Record>;
+
+        // hand each record to `callback` as soon as it is parsed, from the
+        // worker threads and in no particular order
+        void parse(std::string_view input, const std::function<void(Record &&)> &callback) const;
+
+     private:
+        struct Line {
+            std::size_t begin;
+            std::size_t size;
+            std::size_t number;
+        };
+
+        ParseOptions options_;
+        unsigned threads_;
+
+        static auto split(std::string_view input) -> std::vector<Line>;
+        static auto parse_record(ReusableParser &parser, std::string_view input, const Line &line,
+            std::size_t index) -> Record;
+        void run(std::size_t count, const std::function<void(std::size_t, ReusableParser &)> &work) const;
+    };
+
+    // Parses one large array or object on several threads. The input is
+    // cut into pieces that the threads scan for quotes and brackets at
+    // once, then each piece is split at its first top-level comma, which
+    // gives chunks of about the same size. Every chunk is parsed into its own tape, then the tapes
+    // are copied side by side under one root. The document is the same as
+    // the one Parser::parse builds. Small inputs, other roots, duplicate
+    // key handling at the root and invalid input go through Parser, so
+    // errors are reported exactly as it does.
+    class ParallelParser {
+     public:
+        // inputs smaller than this are parsed serially
+        static constexpr std::size_t MIN_PARALLEL_SIZE = 1 << 20;
+
+        // 0 threads means one per hardware thread
+        ParallelParser(ParseOptions options = {}, unsigned threads = 0);
+
+        auto parse(std::string_view json) const -> Document;
+
+     private:
+        struct Chunk {
+            std::size_t begin;
+            std::size_t end;
+            std::size_t count;  // top-level values or members, once parsed
+            Document document;
+            bool failed{false};
+        };
+
+        ParseOptions options_;
+        unsigned threads_;
+
+        auto split(std::string_view json, std::vector<Chunk> &chunks) const -> bool;
+        void parse_chunk(std::string_view json, AstType type, Chunk &chunk) const;
+        static void copy_chunk(const Chunk &chunk, std::size_t strings_offset, std::uint64_t *out);
+        void run(std::size_t count, const std::function<void(std::size_t)> &work) const;
+    };
+
+    enum class BinaryFormat {
+        MESSAGE_PACK,
+        CBOR,
+    };
+
+    // Encodes values as MessagePack or CBOR in one pass over the tape.
+    // Integers use the shortest encoding that holds them and floats are
+    // always 64-bit, so INT and FLOAT stay apart on the way back. The
+    // writer keeps its buffer between calls.
+    class BinaryWriter {
+     public:
+        explicit BinaryWriter(BinaryFormat format) : format_(format) {}
+
+        // the encoding of `node`, valid until the next call
+        auto encode(AstNode node) -> std::string_view;
+
+     private:
+        BinaryFormat format_;
+        std::string buffer_;
+
+        void write_msgpack(const Document &document, std::size_t index);
+        void write_cbor(const Document &document, std::size_t index);
+        void write_big_endian(std::uint64_t value, int bytes);
+        void write_cbor_head(int major, std::uint64_t value);
+    };
+
+    // Decode one MessagePack or CBOR value into a Document. Strings are
+    // referenced in `data`, which must outlive the document. Only the types
+    // json has are accepted: no binary strings, extensions, tags or
+    // indefinite lengths, and map keys must be strings. Throws
+    // std::runtime_error on anything else or on truncated input. Under
+    // DuplicateKeys::KEEP_ALL the tape is written directly, other policies
+    // go through DocumentBuilder to check the keys.
+    auto decode_binary(std::string_view data, BinaryFormat format, ParseOptions options = {}) -> Document;
+
+    // Where rendered text goes. The writes are small pieces, sinks that
+    // end in a system call collect them in a BufferedSink first.
+    class Sink {
+     public:
+        virtual ~Sink() = default;
+
+        virtual void write(std::string_view text) = 0;
+
+        virtual void put(char ch) {
+            write({&ch, 1});
+        }
+    };
+
+    // appends to a string owned by the caller
+    class StringSink : public Sink {
+     public:
+        explicit StringSink(std::string &out) : out_(out) {}
+
+        void write(std::string_view text) override {
+            out_.append(text);
+        }
+
+        void put(char ch) override {
+            out_.push_back(ch);
+        }
+
+     private:
+        std::string &out_;
+    };
+
+    // Collects writes in a fixed buffer and hands them on with drain() when
+    // it is full. Derived classes must call flush() in their destructor.
+    class BufferedSink : public Sink {
+     public:
+        static constexpr std::size_t BUFFER_SIZE = 64 * 1024;
+
+        BufferedSink() : buffer_(std::make_unique<char[]>(BUFFER_SIZE)) {}
+
+        void write(std::string_view text) override;
+
+        void put(char ch) override {
+            if (size_ == BUFFER_SIZE)
+                flush();
+            buffer_[size_++] = ch;
+        }
+
+        void flush();
+
+     protected:
+        virtual void drain(std::string_view text) = 0;
+
+     private:
+        std::unique_ptr<char[]> buffer_;
+        std::size_t size_{0};
+    };
+
+    class StreamSink : public BufferedSink {
+     public:
+        explicit StreamSink(std::ostream &os) : os_(os) {}
+
+        ~StreamSink() override {
+            flush();
+        }
+
+     protected:
+        void drain(std::string_view text) override;
+
+     private:
+        std::ostream &os_;
+    };
+
+    // writes to a file descriptor the caller opened and closes
+    class FileSink : public BufferedSink {
+     public:
+        explicit FileSink(int fd) : fd_(fd) {}
+
+        ~FileSink() override {
+            flush();
+        }
+
+     protected:
+        // throws std::runtime_error if the descriptor can not be written
+        void drain(std::string_view text) override;
+
+     private:
+        int fd_;
+    };
+
+    struct WriteOptions {
+        // spaces per level, 0 writes everything on one line without spaces
+        int indent{0};
+    };
+
+    // Writes a value back out as json. Strings are escaped so that the text
+    // parses to the same value, numbers use the shortest text that reads
+    // back the same, and a float that happens to be whole keeps a ".0" so
+    // that it stays a float. The writer keeps its buffer between calls.
+    class JsonWriter {
+     public:
+        JsonWriter(WriteOptions options = {}) : options_(options) {}
+
+        // the json text of `node`, valid until the next call
+        auto to_json(AstNode node) -> std::string_view;
+
+        // the same text, handed to `sink` in pieces of about
+        // BufferedSink::BUFFER_SIZE
+        void to_json(AstNode node, Sink &sink);
+
+     private:
+        // an open array or object with the next element or member to write
+        struct Frame {
+            AstType type;
+            ArrayNode::iterator element;
+            ArrayNode::iterator elements_end;
+            ObjectNode::iterator member;
+            ObjectNode::iterator members_end;
+            bool first{true};
+        };
+
+        WriteOptions options_;
+        std::string buffer_;
+        std::vector<Frame> stack_;
+
+        void write(AstNode node, Sink *sink);
+        void write_value(AstNode node);
+        void write_string(std::string_view value);
+        void write_double(double value);
+        void new_line(std::size_t depth);
+    };
+
+    // A member of T that is read from and written to the key `name`.
+    template <typename T, typename M>
+    struct Field {
+        std::string_view name;
+        M T::*member;
+    };
+
+    template <typename T, typename M>
+    constexpr auto field(std::string_view name, M T::*member) -> Field<T, M> {
+        return {name, member};
+    }
+
+    // Specialize for a struct to read it from and write it as a json object:
+    //
+    //     template <>
+    //     struct neroll::JsonFields<Point> {
+    //         static constexpr std::tuple fields{
+    //             field("x", &Point::x), field("y", &Point::y),
+    //         };
+    //     };
+    //
+    // The members can be bool, arithmetic types, std::string,
+    // std::string_view, and std::optional or std::vector of any of these,
+    // including other structs with JsonFields.
+    template <typename T>
+    struct JsonFields;
+
+    template <typename T>
+    concept Mapped = requires {
+        JsonFields<T>::fields;
+    };
+
+    // Reads json text straight into typed values, one token at a time and
+    // without building a Document. The keys of an object are compared with
+    // the names of its fields in a sequence the compiler unrolls. Unknown
+    // keys are skipped like LazyDocument skips values, so their contents
+    // are not validated. A missing member is an error unless it is a
+    // std::optional, null resets an optional. A std::string_view member
+    // points into the input, so it can only take strings without escapes.
+    class TypedReader {
+     public:
+        TypedReader(Lexer lexer, ParseOptions options = {})
+            : lexer_(std::move(lexer)), options_(options) {}
+
+        // read the whole input as one value, throws std::runtime_error if it
+        // is not valid json or does not fit the type
+        template <typename T>
+        void read(T &value) {
+            move();
+            read_value(value);
+            move();
+            if (token_.type != TokenType::END)
+                throw_error("unexpected token after the value");
+        }
+
+     private:
+        Lexer lexer_;
+        ParseOptions options_;
+        Token token_;
+        std::string unescaped_; // reused for strings with escape sequences
+        std::size_t depth_{0};
+
+        template <typename T>
+        void read_value(T &value);
+
+        template <typename T>
+        void read_value(std::optional<T> &value);
+
+        template <typename T>
+        void read_value(std::vector<T> &values);
+
+        template <Mapped T>
+        void read_object(T &value);
+
+        void move() {
+            token_ = lexer_.next_token();
+        }
+
+        // the current value is a container of `type`, move into it
+        void open(TokenType type, std::string_view expect);
+        void skip_value();
+
+        [[noreturn]] void throw_error(std::string_view message) const;
+        [[noreturn]] void throw_type_error(std::string_view expect) const;
+        [[noreturn]] void throw_duplicate_key(const Token &key) const;
+        [[noreturn]] void throw_missing_key(std::string_view key) const;
+    };
+
+    template <typename T>
+    void TypedReader::read_value(T &value) {
+        if constexpr (std::is_same_v<T, bool>) {
+            if (token_.type != TokenType::TRUE && token_.type != TokenType::FALSE)
+                throw_type_error("bool");
+            value = token_.type == TokenType::TRUE;
+        } else if constexpr (std::integral<T>) {
+            if (token_.type != TokenType::NUMBER || token_.is_float)
+                throw_type_error("integer");
+            if (!std::in_range<T>(token_.integer))
+                throw_error("integer is out of range");
+            value = static_cast<T>(token_.integer);
+        } else if constexpr (std::floating_point<T>) {
+            if (token_.type != TokenType::NUMBER)
+                throw_type_error("number");
+            value = static_cast<T>(token_.is_float ? token_.floating : static_cast<double>(token_.integer));
+        } else if constexpr (std::is_same_v<T, std::string>) {
+            if (token_.type != TokenType::STRING)
+                throw_type_error("string");
+            value = string_value(token_, unescaped_);
+        } else if constexpr (std::is_same_v<T, std::string_view>) {
+            if (token_.type != TokenType::STRING)
+                throw_type_error("string");
+            if (token_.escaped)
+                throw_error("a string with escape sequences can not be viewed in place");
+            value = token_.content.substr(1, token_.content.size() - 2);
+        } else {
+            static_assert(Mapped<T>, "specialize JsonFields to read this type");
+            read_object(value);
+        }
+    }
+
+    template <typename T>
+    void TypedReader::read_value(std::optional<T> &value) {
+        if (token_.type == TokenType::NIL) {
+            value.reset();
+            return;
+        }
+        read_value(value.emplace());
+    }
+
+    template <typename T>
+    void TypedReader::read_value(std::vector<T> &values) {
+        open(TokenType::LBRACKET, "array");
+        values.clear();
+        if (token_.type != TokenType::RBRACKET) {
+            while (true) {
+                read_value(values.emplace_back());
+                move();
+                if (token_.type == TokenType::RBRACKET)
+                    break;
+                if (token_.type != TokenType::COMMA)
+                    throw_error("missing comma or right bracket when parsing array");
+                move();
+            }
+        }
+        depth_--;
+    }
+
+    template <Mapped T>
+    void TypedReader::read_object(T &value) {
+        constexpr auto &fields = JsonFields<T>::fields;
+        constexpr auto count = std::tuple_size_v<std::remove_cvref_t<decltype(fields)>>;
+        std::bitset<count> seen;
+
+        open(TokenType::LBRACE, "object");
+        if (token_.type != TokenType::RBRACE) {
+            while (true) {
+                if (token_.type != TokenType::STRING)
+                    throw_error("object key should be a string");
+                auto key_token = token_;
+                auto key = string_value(token_, unescaped_);
+                std::size_t index = 0;
+                std::apply([&](const auto &...field) {
+                    ((field.name != key && ++index) && ...);
+                }, fields);
+                move();
+                if (token_.type != TokenType::COLON)
+                    throw_error("expect colon after key");
+                move();
+
+                if (index < count && seen[index]) {
+                    if (options_.duplicate_keys == DuplicateKeys::ERROR)
+                        throw_duplicate_key(key_token);
+                    if (options_.duplicate_keys == DuplicateKeys::KEEP_FIRST)
+                        index = count;
+                }
+                if (index < count) {
+                    seen.set(index);
+                    std::size_t i = 0;
+                    std::apply([&](const auto &...field) {
+                        ((i++ == index && (read_value(value.*field.member), true)) || ...);
+                    }, fields);
+                } else {
+                    skip_value();
+                }
+
+                move();
+                if (token_.type == TokenType::RBRACE)
+                    break;
+                if (token_.type != TokenType::COMMA)
+                    throw_error("missing comma or right brace when parsing object");
+                move();
+            }
+        }
+        depth_--;
+
+        std::size_t i = 0;
+        std::apply([&](const auto &...field) {
+            ([&] {
+                if (!seen[i++]) {
+                    if constexpr (requires { (value.*field.member).reset(); })
+                        (value.*field.member).reset();
+                    else
+                        throw_missing_key(field.name);
+                }
+            }(), ...);
+        }, fields);
+    }
+
+    // Parse `json` as a T. Throws std::runtime_error if it is not valid json
+    // or does not fit the type.
+    template <typename T>
+    auto from_json(std::string_view json, ParseOptions options = {}) -> T {
+        T value{};
+        TypedReader(Lexer{json}, options).read(value);
+        return value;
+    }
+
+    // Writes typed values as json, laid out like JsonWriter does. An empty
+    // optional is written as null.
+    class TypedWriter {
+     public:
+        TypedWriter(WriteOptions options = {}) : options_(options) {}
+
+        // the json text of `value`, valid until the next call
+        template <typename T>
+        auto to_json(const T &value) -> std::string_view {
+            buffer_.clear();
+            write_value(value, 0);
+            return buffer_;
+        }
+
+     private:
+        WriteOptions options_;
+        std::string buffer_;
+
+        template <typename T>
+        void write_value(const T &value, std::size_t depth);
+
+        template <typename T>
+        void write_value(const std::optional<T> &value, std::size_t depth);
+
+        template <typename T>
+        void write_value(const std::vector<T> &values, std::size_t depth);
+
+        void write_integer(std::int64_t value);
+        void write_unsigned(std::uint64_t value);
+        void write_double(double value);
+        void write_string(std::string_view value);
+        void new_line(std::size_t depth);
+    };
+
+    template <typename T>
+    void TypedWriter::write_value(const T &value, std::size_t depth) {
+        if constexpr (std::is_same_v<T, bool>) {
+            buffer_.append(value ? "true" : "false");
+        } else if constexpr (std::integral<T> && std::is_signed_v<T>) {
+            write_integer(value);
+        } else if constexpr (std::integral<T>) {
+            write_unsigned(value);
+        } else if constexpr (std::floating_point<T>) {
+            write_double(value);
+        } else if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+            write_string(value);
+        } else {
+            static_assert(Mapped<T>, "specialize JsonFields to write this type");
+            buffer_.push_back('{');
+            bool first = true;
+            std::apply([&](const auto &...field) {
+                ([&] {
+                    if (!first)
+                        buffer_.push_back(',');
+                    first = false;
+                    new_line(depth + 1);
+                    write_string(field.name);
+                    buffer_.push_back(':');
+                    if (options_.indent > 0)
+                        buffer_.push_back(' ');
+                    write_value(value.*field.member, depth + 1);
+                }(), ...);
+            }, JsonFields<T>::fields);
+            if (!first)
+                new_line(depth);
+            buffer_.push_back('}');
+        }
+    }
+
+    template <typename T>
+    void TypedWriter::write_value(const std::optional<T> &value, std::size_t depth) {
+        if (value)
+            write_value(*value, depth);
+        else
+            buffer_.append("null");
+    }
+
+    template <typename T>
+    void TypedWriter::write_value(const std::vector<T> &values, std::size_t depth) {
+        buffer_.push_back('[');
+        for (std::size_t i = 0; i < values.size(); i++) {
+            if (i > 0)
+                buffer_.push_back(',');
+            new_line(depth + 1);
+            write_value(values[i], depth + 1);
+        }
+        if (!values.empty())
+            new_line(depth);
+        buffer_.push_back(']');
+    }
+
+    // the json text of `value`
+    template <typename T>
+    auto to_json(const T &value, WriteOptions options = {}) -> std::string {
+        return std::string{TypedWriter(options).to_json(value)};
+    }
+
+    // The color of each kind of token, as in config.json.
+    struct ThemeColors {
+        std::string_view number;
+        std::string_view string;
+        std::string_view boolean;
+        std::string_view null;
+        std::string_view brace;
+        std::string_view bracket;
+    };
+
+    // the colors of config.json, parsed while compiling
+    inline constexpr auto DEFAULT_THEME_JSON = parse_static<R"({
+        "number-color": "blue",
+        "string-color": "orange",
+        "bool-color": "red",
+        "null-color": "black",
+        "brace-color": "pink",
+        "bracket-color": "green"
+    })">();
+
+    inline constexpr ThemeColors DEFAULT_THEME_COLORS = [] {
+        auto color = [](std::string_view key) {
+            auto index = DEFAULT_THEME_JSON.find_key(0, key);
+            if (index == 0)
+                static_json_error(0, "missing color in DEFAULT_THEME_JSON");
+            return DEFAULT_THEME_JSON.string_at(index + 2);
+        };
+        return ThemeColors{
+            color("number-color"), color("string-color"), color("bool-color"),
+            color("null-color"), color("brace-color"), color("bracket-color"),
+        };
+    }();
+
+    template <>
+    struct JsonFields<ThemeColors> {
+        static constexpr std::tuple fields{
+            field("number-color", &ThemeColors::number),
+            field("string-color", &ThemeColors::string),
+            field("bool-color", &ThemeColors::boolean),
+            field("null-color", &ThemeColors::null),
+            field("brace-color", &ThemeColors::brace),
+            field("bracket-color", &ThemeColors::bracket),
+        };
+    };
+
+    // The markup Stringifier writes around each kind of token, built once
+    // from the colors. A Theme is immutable, so one instance can be shared
+    // by any number of Stringifiers on any number of threads.
+    class Theme {
+     public:
+        explicit Theme(const ThemeColors &colors);
+
+        // built from DEFAULT_THEME_COLORS on first use, without file io
+        static auto default_theme() -> std::shared_ptr<const Theme>;
+
+        // Read the colors from a file laid out like config.json. Throws
+        // std::runtime_error if the file can not be read or parsed, or if a
+        // color is missing.
+        static auto load(const std::string &path) -> std::shared_ptr<const Theme>;
+
+        // <span style="color: ..."> of each scalar kind
+        std::string_view number_open() const {
+            return number_open_;
+        }
+
+        std::string_view string_open() const {
+            return string_open_;
+        }
+
+        std::string_view bool_open() const {
+            return bool_open_;
+        }
+
+        // whole spans of the tokens that never change
+        std::string_view null_span() const {
+            return null_span_;
+        }
+
+        std::string_view array_open() const {
+            return array_open_;
+        }
+
+        std::string_view array_close() const {
+            return array_close_;
+        }
+
+        std::string_view object_open() const {
+            return object_open_;
+        }
+
+        // the closing brace of an object is preceded by a line break and
+        // the indentation
+        std::string_view object_close_begin() const {
+            return object_close_begin_;
+        }
+
+     private:
+        std::string number_open_;
+        std::string string_open_;
+        std::string bool_open_;
+        std::string null_span_;
+        std::string array_open_;
+        std::string array_close_;
+        std::string object_open_;
+        std::string object_close_begin_;
+    };
+
+    class Stringifier {
+     public:
+        Stringifier(AstNode ast, std::shared_ptr<const Theme> theme = Theme::default_theme())
+            : json_ast_(ast), theme_(std::move(theme)) {}
+
+        // Rendering reuses the stack of open containers of the calls
+        // before, like JsonWriter, and adds to the stats, so a Stringifier
+        // is not shared between threads: each takes its own, they are
+        // cheap to make and share the theme.
+        std::string to_html();
+
+        // render in one pass straight into `sink`
+        void to_html(Sink &sink);
+
+        // the time spent rendering, all zero without NJSON_STATS
+        auto stats() const -> Stats;
+    
+     private:
+        AstNode json_ast_;
+        std::shared_ptr<const Theme> theme_;
+        [[no_unique_address]] StatsStorage stats_;
+
+        // an open array or object of to_html_traverse, with the next
+        // element or member to print
+        struct Frame {
+            AstType type;
+            int layer;
+            ArrayNode::iterator element;
+            ArrayNode::iterator elements_end;
+            ObjectNode::iterator member;
+            ObjectNode::iterator members_end;
+            std::size_t count{0};   // elements or members printed so far
+        };
+
+        std::vector<Frame> stack_;
+
+        void to_html_traverse(AstNode root, int layer, Sink &sink);
 
-        std::string string_color_;
-        std::string number_color_;
-        std::string brace_color_;
-        std::string bracket_color_;
-        std::string bool_color_;
-        std::string null_color_;
+        // prints a scalar, or the opening bracket of a container and pushes it
+        void to_html_value(AstNode node, int layer, Sink &sink);
 
-        void load_config();
+        // a string as it would appear in json, escaped for html
+        static void write_string(Sink &sink, std::string_view value);
 
-        std::string to_html_traverse(const std::shared_ptr<AstNode> &root, int layer) const;
+        static void indent(Sink &sink, int layer);
 
     };
 
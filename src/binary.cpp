@@ -0,0 +1,517 @@
+#include "njson.h"
+
+#include <stdexcept>    // runtime_error
+#include <format>       // format
+#include <bit>          // bit_cast, countr_zero
+#include <cmath>        // ldexp
+#include <limits>       // numeric_limits
+
+namespace {
+
+    using neroll::AstType;
+    using neroll::BinaryFormat;
+
+    // one decoded header: a scalar, or a container and its size
+    struct Item {
+        AstType type;
+        std::int64_t integer{0};
+        double floating{0};
+        bool boolean{false};
+        std::string_view string;
+        std::size_t count{0};   // elements or members
+    };
+
+    class BinaryReader {
+     public:
+        BinaryReader(std::string_view data, BinaryFormat format)
+            : data_(data), format_(format) {}
+
+        auto read_item() -> Item {
+            return format_ == BinaryFormat::MESSAGE_PACK ? read_msgpack() : read_cbor();
+        }
+
+        bool at_end() const {
+            return pos_ == data_.size();
+        }
+
+        [[noreturn]] void throw_error(std::string_view message) const {
+            auto name = format_ == BinaryFormat::MESSAGE_PACK ? "MessagePack" : "CBOR";
+            neroll::throw_exception(std::runtime_error(std::format("error: invalid {} at byte {}: {}", name, pos_, message)));
+        }
+
+     private:
+        std::string_view data_;
+        BinaryFormat format_;
+        std::size_t pos_{0};
+
+        void need(std::size_t size) {
+            if (size > data_.size() - pos_)
+                throw_error("unexpected end of input");
+        }
+
+        auto read_byte() -> std::uint8_t {
+            need(1);
+            return static_cast<std::uint8_t>(data_[pos_++]);
+        }
+
+        auto read_big_endian(int bytes) -> std::uint64_t {
+            need(bytes);
+            std::uint64_t value = 0;
+            for (int i = 0; i < bytes; i++)
+                value = (value << 8) | static_cast<std::uint8_t>(data_[pos_++]);
+            return value;
+        }
+
+        auto read_string(std::uint64_t size) -> std::string_view {
+            need(size);
+            auto string = data_.substr(pos_, size);
+            pos_ += size;
+            return string;
+        }
+
+        // every element takes at least one byte, so a larger count can only
+        // come from a broken header
+        auto read_count(std::uint64_t count, std::size_t bytes_per_item) -> std::size_t {
+            if (count > (data_.size() - pos_) / bytes_per_item)
+                throw_error("container is longer than the input");
+            return count;
+        }
+
+        auto integer(std::uint64_t value) -> Item {
+            if (value > static_cast<std::uint64_t>(std::numeric_limits<std::int64_t>::max()))
+                throw_error("integer out of range");
+            return {AstType::INT, static_cast<std::int64_t>(value)};
+        }
+
+        auto read_msgpack() -> Item {
+            auto byte = read_byte();
+            if (byte <= 0x7f)
+                return {AstType::INT, byte};
+            if (byte >= 0xe0)
+                return {AstType::INT, static_cast<std::int8_t>(byte)};
+            if ((byte & 0xe0) == 0xa0)
+                return {.type = AstType::STRING, .string = read_string(byte & 0x1f)};
+            if ((byte & 0xf0) == 0x90)
+                return {.type = AstType::ARRAY, .count = read_count(byte & 0x0f, 1)};
+            if ((byte & 0xf0) == 0x80)
+                return {.type = AstType::OBJECT, .count = read_count(byte & 0x0f, 2)};
+            switch (byte) {
+                case 0xc0:
+                    return {AstType::NIL};
+                case 0xc2:
+                case 0xc3:
+                    return {.type = AstType::BOOLEAN, .boolean = byte == 0xc3};
+                case 0xca:
+                    return {.type = AstType::FLOAT,
+                        .floating = std::bit_cast<float>(static_cast<std::uint32_t>(read_big_endian(4)))};
+                case 0xcb:
+                    return {.type = AstType::FLOAT, .floating = std::bit_cast<double>(read_big_endian(8))};
+                case 0xcc:
+                    return integer(read_big_endian(1));
+                case 0xcd:
+                    return integer(read_big_endian(2));
+                case 0xce:
+                    return integer(read_big_endian(4));
+                case 0xcf:
+                    return integer(read_big_endian(8));
+                case 0xd0:
+                    return {AstType::INT, static_cast<std::int8_t>(read_big_endian(1))};
+                case 0xd1:
+                    return {AstType::INT, static_cast<std::int16_t>(read_big_endian(2))};
+                case 0xd2:
+                    return {AstType::INT, static_cast<std::int32_t>(read_big_endian(4))};
+                case 0xd3:
+                    return {AstType::INT, static_cast<std::int64_t>(read_big_endian(8))};
+                case 0xd9:
+                    return {.type = AstType::STRING, .string = read_string(read_big_endian(1))};
+                case 0xda:
+                    return {.type = AstType::STRING, .string = read_string(read_big_endian(2))};
+                case 0xdb:
+                    return {.type = AstType::STRING, .string = read_string(read_big_endian(4))};
+                case 0xdc:
+                    return {.type = AstType::ARRAY, .count = read_count(read_big_endian(2), 1)};
+                case 0xdd:
+                    return {.type = AstType::ARRAY, .count = read_count(read_big_endian(4), 1)};
+                case 0xde:
+                    return {.type = AstType::OBJECT, .count = read_count(read_big_endian(2), 2)};
+                case 0xdf:
+                    return {.type = AstType::OBJECT, .count = read_count(read_big_endian(4), 2)};
+                default:
+                    throw_error(std::format("unsupported type 0x{:02x}", byte));
+            }
+        }
+
+        static double half_to_double(std::uint16_t half) {
+            int exponent = (half >> 10) & 0x1f;
+            int mantissa = half & 0x3ff;
+            double value;
+            if (exponent == 0)
+                value = std::ldexp(mantissa, -24);
+            else if (exponent != 31)
+                value = std::ldexp(mantissa + 1024, exponent - 25);
+            else
+                value = mantissa == 0 ? std::numeric_limits<double>::infinity() : std::numeric_limits<double>::quiet_NaN();
+            return (half & 0x8000) ? -value : value;
+        }
+
+        auto read_cbor() -> Item {
+            auto byte = read_byte();
+            int major = byte >> 5;
+            int info = byte & 0x1f;
+
+            if (major == 7) {
+                switch (info) {
+                    case 20:
+                    case 21:
+                        return {.type = AstType::BOOLEAN, .boolean = info == 21};
+                    case 22:
+                        return {AstType::NIL};
+                    case 25:
+                        return {.type = AstType::FLOAT,
+                            .floating = half_to_double(static_cast<std::uint16_t>(read_big_endian(2)))};
+                    case 26:
+                        return {.type = AstType::FLOAT,
+                            .floating = std::bit_cast<float>(static_cast<std::uint32_t>(read_big_endian(4)))};
+                    case 27:
+                        return {.type = AstType::FLOAT, .floating = std::bit_cast<double>(read_big_endian(8))};
+                    default:
+                        throw_error(std::format("unsupported simple value {}", info));
+                }
+            }
+
+            std::uint64_t argument;
+            if (info < 24)
+                argument = info;
+            else if (info <= 27)
+                argument = read_big_endian(1 << (info - 24));
+            else
+                throw_error(info == 31 ? "indefinite lengths are not supported" : "invalid additional information");
+
+            switch (major) {
+                case 0:
+                    return integer(argument);
+                case 1:
+                    // -1 - argument, which fits exactly when argument does
+                    return {AstType::INT, -1 - integer(argument).integer};
+                case 3:
+                    return {.type = AstType::STRING, .string = read_string(argument)};
+                case 4:
+                    return {.type = AstType::ARRAY, .count = read_count(argument, 1)};
+                case 5:
+                    return {.type = AstType::OBJECT, .count = read_count(argument, 2)};
+                default:
+                    throw_error(major == 2 ? "byte strings are not supported" : "tags are not supported");
+            }
+        }
+    };
+
+    // an open container and how many elements or members it still expects
+    struct Open {
+        AstType type;
+        std::size_t remaining;
+        std::size_t index{0};   // header slot on the tape, for decode_tape
+    };
+
+    [[noreturn]] void throw_too_deep(const BinaryReader &reader, std::size_t max_depth) {
+        reader.throw_error(std::format("nesting is deeper than the maximum depth {}", max_depth));
+    }
+
+    // Hands the value to a DocumentBuilder, which checks keys for
+    // duplicates.
+    void decode_built(BinaryReader &reader, neroll::DocumentBuilder &builder, std::size_t max_depth) {
+        std::vector<Open> open;
+        while (true) {
+            if (!open.empty() && open.back().type == AstType::OBJECT) {
+                auto key = reader.read_item();
+                if (key.type != AstType::STRING)
+                    reader.throw_error("map key should be a string");
+                if (!builder.on_key(key.string))
+                    reader.throw_error(std::format("duplicate key {}", key.string));
+            }
+
+            auto item = reader.read_item();
+            switch (item.type) {
+                case AstType::INT:
+                    builder.on_int(item.integer);
+                    break;
+                case AstType::FLOAT:
+                    builder.on_double(item.floating);
+                    break;
+                case AstType::STRING:
+                    builder.on_string(item.string);
+                    break;
+                case AstType::BOOLEAN:
+                    builder.on_bool(item.boolean);
+                    break;
+                case AstType::NIL:
+                    builder.on_null();
+                    break;
+                case AstType::ARRAY:
+                case AstType::OBJECT:
+                    if (open.size() >= max_depth)
+                        throw_too_deep(reader, max_depth);
+                    if (item.type == AstType::ARRAY)
+                        builder.on_start_array();
+                    else
+                        builder.on_start_object();
+                    if (item.count != 0) {
+                        open.push_back({item.type, item.count});
+                        continue;
+                    }
+                    if (item.type == AstType::ARRAY)
+                        builder.on_end_array();
+                    else
+                        builder.on_end_object();
+                    break;
+            }
+
+            // a value is complete, close the containers that end with it
+            while (!open.empty() && --open.back().remaining == 0) {
+                if (open.back().type == AstType::ARRAY)
+                    builder.on_end_array();
+                else
+                    builder.on_end_object();
+                open.pop_back();
+            }
+            if (open.empty())
+                break;
+        }
+    }
+
+    // Writes the tape directly, when every member is kept. Both formats
+    // give the size of a container up front, so its count slot is written
+    // when it opens and only the slot count waits for its end. Strings
+    // always lie in `data`, the document's source. Returns whether an
+    // object is large enough for a hash index.
+    bool decode_tape(BinaryReader &reader, std::string_view data, std::vector<std::uint64_t> &tape,
+            std::size_t max_depth) {
+        using neroll::Document;
+        auto header = [](AstType type, std::uint64_t payload) {
+            return (static_cast<std::uint64_t>(type) << Document::TAG_SHIFT) | payload;
+        };
+        auto append_string = [&](std::string_view value) {
+            tape.push_back(header(AstType::STRING, Document::SOURCE_STRING | static_cast<std::uint64_t>(value.data() - data.data())));
+            tape.push_back(value.size());
+        };
+
+        bool large_object = false;
+        std::vector<Open> open;
+        while (true) {
+            if (!open.empty() && open.back().type == AstType::OBJECT) {
+                auto key = reader.read_item();
+                if (key.type != AstType::STRING)
+                    reader.throw_error("map key should be a string");
+                append_string(key.string);
+            }
+
+            auto item = reader.read_item();
+            switch (item.type) {
+                case AstType::INT:
+                    tape.push_back(header(AstType::INT, 0));
+                    tape.push_back(std::bit_cast<std::uint64_t>(item.integer));
+                    break;
+                case AstType::FLOAT:
+                    tape.push_back(header(AstType::FLOAT, 0));
+                    tape.push_back(std::bit_cast<std::uint64_t>(item.floating));
+                    break;
+                case AstType::STRING:
+                    append_string(item.string);
+                    break;
+                case AstType::BOOLEAN:
+                    tape.push_back(header(AstType::BOOLEAN, item.boolean ? 1 : 0));
+                    break;
+                case AstType::NIL:
+                    tape.push_back(header(AstType::NIL, 0));
+                    break;
+                case AstType::ARRAY:
+                case AstType::OBJECT:
+                    if (open.size() >= max_depth)
+                        throw_too_deep(reader, max_depth);
+                    if (item.type == AstType::OBJECT && item.count >= Document::HASH_INDEX_THRESHOLD)
+                        large_object = true;
+                    if (item.count != 0) {
+                        open.push_back({item.type, item.count, tape.size()});
+                        tape.push_back(header(item.type, 0));
+                        tape.push_back(item.count);
+                        continue;
+                    }
+                    tape.push_back(header(item.type, 2));
+                    tape.push_back(0);
+                    break;
+            }
+
+            // a value is complete, close the containers that end with it
+            while (!open.empty() && --open.back().remaining == 0) {
+                tape[open.back().index] |= tape.size() - open.back().index;
+                open.pop_back();
+            }
+            if (open.empty())
+                break;
+        }
+        return large_object;
+    }
+
+}
+
+auto neroll::decode_binary(std::string_view data, BinaryFormat format, ParseOptions options) -> Document {
+    Document document(data);
+    BinaryReader reader(data, format);
+    if (options.duplicate_keys == DuplicateKeys::KEEP_ALL) {
+        // Growing the tape costs more than decoding into it. Records and
+        // numbers take about one slot per two to five bytes, so half a slot
+        // per byte rarely grows; pages that stay unused are never touched,
+        // and a tape that used far less is given back.
+        auto &tape = document.tape_;
+        tape.reserve(data.size() / 2 + 2);
+        // created up front so that concurrent lookups only share the mutex
+        if (decode_tape(reader, data, tape, options.max_depth))
+            document.enable_key_indexes();
+        if (tape.size() < tape.capacity() / 4)
+            tape.shrink_to_fit();
+    } else {
+        DocumentBuilder builder(document, options.duplicate_keys);
+        decode_built(reader, builder, options.max_depth);
+    }
+
+    if (!reader.at_end())
+        reader.throw_error("unexpected data after the value");
+    return document;
+}
+
+auto neroll::BinaryWriter::encode(AstNode node) -> std::string_view {
+    buffer_.clear();
+    const auto &document = node.document();
+    auto end = document.next_index(node.index());
+    // the tape is already in document order with the size of every
+    // container up front, which is all both formats need
+    for (auto i = node.index(); i < end; i = i + (document.type_at(i) == AstType::BOOLEAN
+            || document.type_at(i) == AstType::NIL ? 1 : 2)) {
+        if (format_ == BinaryFormat::MESSAGE_PACK)
+            write_msgpack(document, i);
+        else
+            write_cbor(document, i);
+    }
+    return buffer_;
+}
+
+void neroll::BinaryWriter::write_big_endian(std::uint64_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--)
+        buffer_.push_back(static_cast<char>(value >> (i * 8)));
+}
+
+// the header of one tape slot, containers are followed by their contents
+void neroll::BinaryWriter::write_msgpack(const Document &document, std::size_t index) {
+    // the fix type for short sizes, otherwise `type16` or the 32-bit type
+    // after it followed by the size
+    auto write_size = [&](std::uint64_t size, int fix_type, std::uint64_t fix_limit, int type16) {
+        if (size < fix_limit) {
+            buffer_.push_back(static_cast<char>(fix_type | size));
+        } else if (size <= 0xffff) {
+            buffer_.push_back(static_cast<char>(type16));
+            write_big_endian(size, 2);
+        } else {
+            buffer_.push_back(static_cast<char>(type16 + 1));
+            write_big_endian(size, 4);
+        }
+    };
+
+    switch (document.type_at(index)) {
+        case AstType::INT: {
+            auto value = std::bit_cast<std::int64_t>(document.slot_at(index + 1));
+            if (value >= -32 && value <= 0x7f) {
+                buffer_.push_back(static_cast<char>(value));
+            } else if (value > 0) {
+                auto bytes = value <= 0xff ? 1 : value <= 0xffff ? 2 : value <= 0xffffffff ? 4 : 8;
+                buffer_.push_back(static_cast<char>(0xcc + std::countr_zero(static_cast<unsigned>(bytes))));
+                write_big_endian(value, bytes);
+            } else {
+                auto bytes = value >= INT8_MIN ? 1 : value >= INT16_MIN ? 2 : value >= INT32_MIN ? 4 : 8;
+                buffer_.push_back(static_cast<char>(0xd0 + std::countr_zero(static_cast<unsigned>(bytes))));
+                write_big_endian(static_cast<std::uint64_t>(value), bytes);
+            }
+        }
+        break;
+        case AstType::FLOAT:
+            buffer_.push_back(static_cast<char>(0xcb));
+            write_big_endian(document.slot_at(index + 1), 8);
+            break;
+        case AstType::STRING: {
+            auto value = document.string_at(index);
+            if (value.size() >= 32 && value.size() <= 0xff) {
+                buffer_.push_back(static_cast<char>(0xd9));
+                write_big_endian(value.size(), 1);
+            } else {
+                write_size(value.size(), 0xa0, 32, 0xda);
+            }
+            buffer_.append(value);
+        }
+        break;
+        case AstType::BOOLEAN:
+            buffer_.push_back(static_cast<char>(document.payload_at(index) ? 0xc3 : 0xc2));
+            break;
+        case AstType::NIL:
+            buffer_.push_back(static_cast<char>(0xc0));
+            break;
+        case AstType::ARRAY:
+            write_size(document.slot_at(index + 1), 0x90, 16, 0xdc);
+            break;
+        case AstType::OBJECT:
+            write_size(document.slot_at(index + 1), 0x80, 16, 0xde);
+            break;
+    }
+}
+
+void neroll::BinaryWriter::write_cbor_head(int major, std::uint64_t value) {
+    auto type = static_cast<char>(major << 5);
+    if (value < 24) {
+        buffer_.push_back(static_cast<char>(type | value));
+    } else if (value <= 0xff) {
+        buffer_.push_back(static_cast<char>(type | 24));
+        write_big_endian(value, 1);
+    } else if (value <= 0xffff) {
+        buffer_.push_back(static_cast<char>(type | 25));
+        write_big_endian(value, 2);
+    } else if (value <= 0xffffffff) {
+        buffer_.push_back(static_cast<char>(type | 26));
+        write_big_endian(value, 4);
+    } else {
+        buffer_.push_back(static_cast<char>(type | 27));
+        write_big_endian(value, 8);
+    }
+}
+
+void neroll::BinaryWriter::write_cbor(const Document &document, std::size_t index) {
+    switch (document.type_at(index)) {
+        case AstType::INT: {
+            auto value = std::bit_cast<std::int64_t>(document.slot_at(index + 1));
+            // a negative n is stored as -1 - n, which is ~n
+            if (value >= 0)
+                write_cbor_head(0, static_cast<std::uint64_t>(value));
+            else
+                write_cbor_head(1, ~static_cast<std::uint64_t>(value));
+        }
+        break;
+        case AstType::FLOAT:
+            buffer_.push_back(static_cast<char>(0xfb));
+            write_big_endian(document.slot_at(index + 1), 8);
+            break;
+        case AstType::STRING: {
+            auto value = document.string_at(index);
+            write_cbor_head(3, value.size());
+            buffer_.append(value);
+        }
+        break;
+        case AstType::BOOLEAN:
+            buffer_.push_back(static_cast<char>(document.payload_at(index) ? 0xf5 : 0xf4));
+            break;
+        case AstType::NIL:
+            buffer_.push_back(static_cast<char>(0xf6));
+            break;
+        case AstType::ARRAY:
+            write_cbor_head(4, document.slot_at(index + 1));
+            break;
+        case AstType::OBJECT:
+            write_cbor_head(5, document.slot_at(index + 1));
+            break;
+    }
+}
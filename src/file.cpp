@@ -0,0 +1,88 @@
+#include "njson.h"
+
+#include <stdexcept>    // runtime_error
+#include <format>       // format
+#include <fstream>      // ifstream
+#include <iterator>     // istreambuf_iterator
+
+// define NJSON_NO_MMAP to always read files into a buffer
+#if !defined(NJSON_NO_MMAP) && (defined(__unix__) || defined(__APPLE__))
+#define NJSON_MMAP 1
+#include <fcntl.h>      // open
+#include <unistd.h>     // close
+#include <sys/mman.h>   // mmap, madvise, munmap
+#include <sys/stat.h>   // fstat
+#endif
+
+neroll::MappedFile::MappedFile(const std::string &path, [[maybe_unused]] bool sequential) {
+#ifdef NJSON_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw_exception(std::runtime_error(std::format("can not open file {}", path)));
+    struct stat status;
+    bool mapped = ::fstat(fd, &status) == 0 && S_ISREG(status.st_mode)
+        && map(fd, static_cast<std::size_t>(status.st_size), sequential);
+    ::close(fd);
+    if (mapped)
+        return;
+#endif
+    read(path);
+}
+
+neroll::MappedFile::~MappedFile() {
+#ifdef NJSON_MMAP
+    if (mapping_ != nullptr)
+        ::munmap(mapping_, data_.size());
+#endif
+}
+
+bool neroll::MappedFile::map([[maybe_unused]] int fd, [[maybe_unused]] std::size_t size,
+        [[maybe_unused]] bool sequential) {
+#ifdef NJSON_MMAP
+    // mmap rejects empty ranges, an empty file has nothing to map anyway
+    if (size == 0)
+        return true;
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    if (sequential)
+        flags |= MAP_POPULATE;  // fault the pages in now, in one go
+#endif
+    void *mapping = ::mmap(nullptr, size, PROT_READ, flags, fd, 0);
+    if (mapping == MAP_FAILED)
+        return false;
+    if (sequential)
+        ::madvise(mapping, size, MADV_SEQUENTIAL);
+    mapping_ = mapping;
+    data_ = {static_cast<const char *>(mapping), size};
+    return true;
+#else
+    return false;
+#endif
+}
+
+// one read of the whole file into buffer_, or a stream read for input
+// that has no size, like a pipe
+void neroll::MappedFile::read(const std::string &path) {
+    std::ifstream fin(path, std::ios::binary);
+    if (!fin)
+        throw_exception(std::runtime_error(std::format("can not open file {}", path)));
+    auto size = fin.seekg(0, std::ios::end).tellg();
+    if (size >= 0) {
+        buffer_.resize(static_cast<std::size_t>(size));
+        fin.seekg(0);
+        fin.read(buffer_.data(), static_cast<std::streamsize>(size));
+    } else {
+        fin.clear();
+        buffer_.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+    }
+    if (fin.bad() || (size >= 0 && !fin))
+        throw_exception(std::runtime_error(std::format("can not read file {}", path)));
+    data_ = buffer_;
+}
+
+auto neroll::parse_file(const std::string &path, ParseOptions options) -> Document {
+    auto file = std::make_shared<const MappedFile>(path);
+    auto document = Parser(Lexer{file->data()}, options).parse();
+    document.file_ = std::move(file);
+    return document;
+}
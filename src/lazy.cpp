@@ -0,0 +1,152 @@
+#include "njson.h"
+
+#include <stdexcept>    // out_of_range
+#include <format>       // format
+
+auto neroll::LazyDocument::lexer_at(std::size_t offset) const -> Lexer {
+    Lexer lexer{json_};
+    lexer.seek(offset);
+    return lexer;
+}
+
+auto neroll::LazyDocument::root() -> LazyValue {
+    auto lexer = lexer_at(0);
+    auto token = lexer.next_token();
+    lexer.expect_value(token);
+    return {this, token.offset};
+}
+
+auto neroll::LazyValue::type() const -> AstType {
+    switch (document_->json_[offset_]) {
+        case '{':
+            return AstType::OBJECT;
+        case '[':
+            return AstType::ARRAY;
+        case '\"':
+            return AstType::STRING;
+        case 't':
+        case 'f':
+            return AstType::BOOLEAN;
+        case 'n':
+            return AstType::NIL;
+        default:
+            return scalar().is_float ? AstType::FLOAT : AstType::INT;
+    }
+}
+
+auto neroll::LazyValue::find(std::string_view key) const -> std::optional<LazyValue> {
+    auto lexer = document_->lexer_at(offset_);
+    auto token = lexer.next_token();
+    if (token.type != TokenType::LBRACE)
+        throw_type_error(token, "object");
+    token = lexer.next_token();
+    if (token.type == TokenType::RBRACE)
+        return std::nullopt;
+
+    std::string scratch;
+    while (true) {
+        if (token.type != TokenType::STRING)
+            lexer.throw_error(token.offset, "object key should be a string");
+        bool found = string_value(token, scratch) == key;
+        token = lexer.next_token();
+        if (token.type != TokenType::COLON)
+            lexer.throw_error(token.offset, "expect colon after key");
+
+        token = lexer.next_token();
+        lexer.expect_value(token);
+        if (found)
+            return LazyValue{document_, token.offset};
+        lexer.skip_value(token);
+
+        token = lexer.next_token();
+        if (token.type == TokenType::COMMA)
+            token = lexer.next_token();
+        else if (token.type == TokenType::RBRACE)
+            return std::nullopt;
+        else
+            lexer.throw_error(token.offset, "missing comma or right brace when parsing object");
+    }
+}
+
+auto neroll::LazyValue::operator[](std::string_view key) const -> LazyValue {
+    auto value = find(key);
+    if (!value)
+        throw_exception(std::out_of_range(std::format("key {} not found", key)));
+    return *value;
+}
+
+auto neroll::LazyValue::operator[](std::size_t index) const -> LazyValue {
+    auto lexer = document_->lexer_at(offset_);
+    auto token = lexer.next_token();
+    if (token.type != TokenType::LBRACKET)
+        throw_type_error(token, "array");
+    token = lexer.next_token();
+    if (token.type != TokenType::RBRACKET) {
+        for (std::size_t i = 0; ; i++) {
+            lexer.expect_value(token);
+            if (i == index)
+                return {document_, token.offset};
+            lexer.skip_value(token);
+
+            token = lexer.next_token();
+            if (token.type == TokenType::COMMA)
+                token = lexer.next_token();
+            else if (token.type == TokenType::RBRACKET)
+                break;
+            else
+                lexer.throw_error(token.offset, "missing comma or right bracket when parsing array");
+        }
+    }
+    throw_exception(std::out_of_range(std::format("index {} out of range", index)));
+}
+
+auto neroll::LazyValue::get_int64() const -> int64_t {
+    auto token = scalar();
+    if (token.type != TokenType::NUMBER || token.is_float)
+        throw_type_error(token, "integer");
+    return token.integer;
+}
+
+auto neroll::LazyValue::get_double() const -> double {
+    auto token = scalar();
+    if (token.type != TokenType::NUMBER)
+        throw_type_error(token, "number");
+    return token.is_float ? token.floating : static_cast<double>(token.integer);
+}
+
+auto neroll::LazyValue::get_bool() const -> bool {
+    auto token = scalar();
+    if (token.type != TokenType::TRUE && token.type != TokenType::FALSE)
+        throw_type_error(token, "boolean");
+    return token.type == TokenType::TRUE;
+}
+
+// decoded strings are kept by the document, so the view stays valid
+auto neroll::LazyValue::get_string() const -> std::string_view {
+    auto token = scalar();
+    if (token.type != TokenType::STRING)
+        throw_type_error(token, "string");
+    if (!token.escaped)
+        return token.content.substr(1, token.content.size() - 2);
+    return string_value(token, document_->decoded_.emplace_back());
+}
+
+auto neroll::LazyValue::is_null() const -> bool {
+    return document_->json_[offset_] == 'n' && scalar().type == TokenType::NIL;
+}
+
+auto neroll::LazyValue::raw() const -> std::string_view {
+    auto lexer = document_->lexer_at(offset_);
+    lexer.skip_value(lexer.next_token());
+    return document_->json_.substr(offset_, lexer.offset() - offset_);
+}
+
+// the first token of the value, which is all of it unless it is a container
+auto neroll::LazyValue::scalar() const -> Token {
+    return document_->lexer_at(offset_).next_token();
+}
+
+void neroll::LazyValue::throw_type_error(const Token &token, std::string_view expected) const {
+    document_->lexer_at(offset_).throw_error(token.offset,
+        std::format("expect {}, get {}", expected, token.content));
+}
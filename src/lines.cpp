@@ -0,0 +1,90 @@
+#include "njson.h"
+
+#include <cstring>      // memchr
+#include <thread>       // thread
+#include <atomic>       // atomic
+#include <algorithm>    // min
+
+namespace {
+
+    // records a worker takes at once, small enough to balance uneven lines
+    constexpr std::size_t BATCH_SIZE = 64;
+
+    bool is_blank(std::string_view text) {
+        return text.find_first_not_of(" \t\r") == std::string_view::npos;
+    }
+
+}
+
+neroll::LinesParser::LinesParser(ParseOptions options, unsigned threads)
+    : options_(options), threads_(threads) {
+    if (threads_ == 0)
+        threads_ = std::max(1u, std::thread::hardware_concurrency());
+}
+
+auto neroll::LinesParser::split(std::string_view input) -> std::vector<Line> {
+    std::vector<Line> lines;
+    std::size_t begin = 0;
+    for (std::size_t number = 1; begin < input.size(); number++) {
+        auto *newline = static_cast<const char *>(
+            std::memchr(input.data() + begin, '\n', input.size() - begin));
+        std::size_t end = newline ? newline - input.data() : input.size();
+        if (!is_blank(input.substr(begin, end - begin)))
+            lines.push_back({begin, end - begin, number});
+        begin = end + 1;
+    }
+    return lines;
+}
+
+auto neroll::LinesParser::parse_record(ReusableParser &parser, std::string_view input,
+        const Line &line, std::size_t index) -> Record {
+    Record record{index, line.number, Document{}, {}};
+    if (parser.try_parse(input.substr(line.begin, line.size), {line.number, 1}) && parser.try_expect_end())
+        record.document = parser.release();
+    else
+        record.error = parser.error().message();
+    return record;
+}
+
+// Calls `work` for every index below `count`, spread over the threads in
+// batches. The calling thread is one of the workers. Each worker has its
+// own parser, whose buffers serve all of its records.
+void neroll::LinesParser::run(std::size_t count,
+        const std::function<void(std::size_t, ReusableParser &)> &work) const {
+    std::atomic<std::size_t> next{0};
+    auto worker = [&] {
+        ReusableParser parser(options_);
+        while (true) {
+            auto begin = next.fetch_add(BATCH_SIZE, std::memory_order_relaxed);
+            if (begin >= count)
+                return;
+            for (auto i = begin; i < std::min(begin + BATCH_SIZE, count); i++)
+                work(i, parser);
+        }
+    };
+
+    auto extra = std::min<std::size_t>(threads_, (count + BATCH_SIZE - 1) / BATCH_SIZE);
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < extra; i++)
+        workers.emplace_back(worker);
+    worker();
+    for (auto &thread : workers)
+        thread.join();
+}
+
+auto neroll::LinesParser::parse(std::string_view input) const -> std::vector<Record> {
+    auto lines = split(input);
+    std::vector<Record> records(lines.size());
+    run(lines.size(), [&](std::size_t i, ReusableParser &parser) {
+        records[i] = parse_record(parser, input, lines[i], i);
+    });
+    return records;
+}
+
+void neroll::LinesParser::parse(std::string_view input,
+        const std::function<void(Record &&)> &callback) const {
+    auto lines = split(input);
+    run(lines.size(), [&](std::size_t i, ReusableParser &parser) {
+        callback(parse_record(parser, input, lines[i], i));
+    });
+}
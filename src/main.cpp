@@ -2,7 +2,6 @@
 #include <format>
 #include <memory>
 #include <fstream>
-#include <sstream>
 #include <chrono>
 #include <ctime>
 
@@ -13,22 +12,13 @@ using std::format;
 using namespace neroll;
 
 int main() {
-    std::ifstream fin("test.json");
-    std::ostringstream out;
-    out << fin.rdbuf();
-
-    std::string json(out.str());
-
     try {
-        Parser parser(Lexer{json});
-
-        auto root = parser.parse();
-
-        auto object = std::static_pointer_cast<ObjectNode>(root);
+        auto document = parse_file("test.json");
 
         std::ofstream fout("index.html");
-        Stringifier stringifier(root);
-        fout << stringifier.to_html();
+        StreamSink sink(fout);
+        Stringifier stringifier(document.root(), Theme::load("config.json"));
+        stringifier.to_html(sink);
 
     } catch (std::runtime_error &e) {
         cout << e.what() << endl;
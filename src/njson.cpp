@@ -1,13 +1,65 @@
 #include "njson.h"
 
-#include <stdexcept>    // runtime_error
+#include <stdexcept>    // runtime_error, out_of_range
 #include <format>       // format
 #include <iostream>     // ostream
-#include <algorithm>    // any_of
+#include <algorithm>    // min, lower_bound, sort, copy, count
 #include <ranges>
-#include <charconv>     // from_chars
-#include <fstream>      // ifstream
-#include <sstream>      // ostringstream
+#include <charconv>     // from_chars, to_chars
+#include <cmath>        // isinf
+#include <cstdint>      // INT64_MAX
+#include <functional>   // less_equal, hash
+#include <shared_mutex> // shared_mutex, shared_lock
+#include <mutex>        // unique_lock
+
+namespace {
+
+    int hex_digit(char ch) {
+        if (ch >= '0' && ch <= '9')
+            return ch - '0';
+        if (ch >= 'a' && ch <= 'f')
+            return ch - 'a' + 10;
+        if (ch >= 'A' && ch <= 'F')
+            return ch - 'A' + 10;
+        return -1;
+    }
+
+    int hex4(const char *pos) {
+        return hex_digit(pos[0]) << 12 | hex_digit(pos[1]) << 8 | hex_digit(pos[2]) << 4 | hex_digit(pos[3]);
+    }
+
+    void append_utf8(std::string &out, std::uint32_t code) {
+        if (code < 0x80) {
+            out.push_back(static_cast<char>(code));
+        } else if (code < 0x800) {
+            out.push_back(static_cast<char>(0xC0 | (code >> 6)));
+            out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        } else if (code < 0x10000) {
+            out.push_back(static_cast<char>(0xE0 | (code >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        } else {
+            out.push_back(static_cast<char>(0xF0 | (code >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        }
+    }
+
+    // Line and column of a byte offset of `source`, which starts at
+    // `origin` of a larger text: only its first line is shifted by the
+    // origin's column. Errors are located once, so the newlines are
+    // counted on the spot rather than indexed.
+    auto locate(std::string_view source, std::size_t offset, neroll::Location origin) -> neroll::Location {
+        auto before = source.substr(0, offset);
+        auto newline = before.rfind('\n');
+        auto line_start = newline == std::string_view::npos ? 0 : newline + 1;
+        auto line = static_cast<std::size_t>(std::ranges::count(before, '\n'));
+        auto column = offset - line_start + 1 + (line == 0 ? origin.column - 1 : 0);
+        return {line + origin.line, column};
+    }
+
+}
 
 auto neroll::token_name(TokenType type) -> const char * {
     switch (type) {
@@ -35,8 +87,10 @@ auto neroll::token_name(TokenType type) -> const char * {
             return "TRUE";
         case TokenType::COLON:
             return "COLON";
+        case TokenType::ERROR:
+            return "ERROR";
         default:
-            throw std::runtime_error("unknown token type");
+            throw_exception(std::runtime_error("unknown token type"));
     }
 }
 
@@ -54,14 +108,8 @@ auto neroll::Lexer::parse_white() -> void {
         switch (*json_) {
             case ' ':
             case '\t':
-                colno_++;
-                break;
             case '\r':
-                colno_ = 1;
-                break;
             case '\n':
-                colno_ = 1;
-                lineno_++;
                 break;
             default:
                 return;
@@ -70,6 +118,195 @@ auto neroll::Lexer::parse_white() -> void {
     }
 }
 
+void neroll::unescape(std::string_view body, std::string &out) {
+    std::size_t i = 0;
+    while (i < body.size()) {
+        auto next = body.find('\\', i);
+        if (next == std::string_view::npos) {
+            out.append(body.substr(i));
+            return;
+        }
+        out.append(body.substr(i, next - i));
+        i = next + 1;
+        switch (body[i++]) {
+            case 'b':
+                out.push_back('\b');
+                break;
+            case 'f':
+                out.push_back('\f');
+                break;
+            case 'n':
+                out.push_back('\n');
+                break;
+            case 'r':
+                out.push_back('\r');
+                break;
+            case 't':
+                out.push_back('\t');
+                break;
+            case 'u': {
+                std::uint32_t code = hex4(body.data() + i);
+                i += 4;
+                if (code >= 0xD800 && code <= 0xDBFF) {
+                    std::uint32_t low = hex4(body.data() + i + 2);
+                    i += 6;
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+                append_utf8(out, code);
+                break;
+            }
+            default:    // \\ \/ \"
+                out.push_back(body[i - 1]);
+                break;
+        }
+    }
+}
+
+auto neroll::string_value(const Token &token, std::string &scratch) -> std::string_view {
+    auto body = token.content.substr(1, token.content.size() - 2);
+    if (!token.escaped)
+        return body;
+    scratch.clear();
+    unescape(body, scratch);
+    return scratch;
+}
+
+void neroll::Lexer::build_index() {
+    if (static_cast<std::size_t>(end_ - begin_) > UINT32_MAX)
+        return;
+    indexed_ = true;
+    index_from(offset());
+}
+
+void neroll::Lexer::index_from(std::size_t offset) {
+    find_structurals(source(), offset, INDEX_WINDOW, index_);
+    next_structural_ = 0;
+}
+
+void neroll::Lexer::seek(std::size_t offset) {
+    json_ = begin_ + offset;
+    if (indexed_)
+        index_from(offset);
+}
+
+void neroll::Lexer::skip_container() {
+    std::size_t depth = 1;
+    while (json_ < end_) {
+        switch (*json_++) {
+            case '\"':
+                while (json_ < end_ && *json_ != '\"') {
+                    if (*json_ == '\\' && ++json_ == end_)
+                        break;
+                    json_++;
+                }
+                if (json_ >= end_)
+                    throw_error(offset(), "unterminated string");
+                json_++;
+                break;
+            case '{':
+            case '[':
+                depth++;
+                break;
+            case '}':
+            case ']':
+                if (--depth == 0)
+                    return;
+                break;
+            default:
+                break;
+        }
+    }
+    throw_error(offset(), "unexpected end of input");
+}
+
+void neroll::Lexer::expect_value(const Token &token) const {
+    switch (token.type) {
+        case TokenType::LBRACE:
+        case TokenType::LBRACKET:
+        case TokenType::STRING:
+        case TokenType::NUMBER:
+        case TokenType::TRUE:
+        case TokenType::FALSE:
+        case TokenType::NIL:
+            return;
+        case TokenType::END:
+            throw_error(token.offset, "unexpected end of input");
+        default:
+            throw_error(token.offset, std::format("invalid token type: {}", token.name()));
+    }
+}
+
+void neroll::Lexer::skip_value(const Token &first) {
+    if (first.type == TokenType::LBRACE || first.type == TokenType::LBRACKET)
+        skip_container();
+}
+
+auto neroll::Lexer::location(std::size_t offset) const -> Location {
+    return locate(source(), offset, origin_);
+}
+
+void neroll::Lexer::throw_error(std::size_t offset, std::string_view message) const {
+    auto [line, column] = location(offset);
+    throw_exception(std::runtime_error(std::format("error: line {}, column {}: {}", line, column, message)));
+}
+
+auto neroll::ParseError::message() const -> std::string {
+    auto detail = [&]() -> std::string {
+        switch (code) {
+            case ErrorCode::NONE:
+                return "no error";
+            case ErrorCode::INVALID_TOKEN:
+                return "invalid token";
+            case ErrorCode::INVALID_LITERAL:
+                return std::format("unknow indentifier {}, do you mean '{}'?", text,
+                    text[0] == 't' ? "true" : text[0] == 'f' ? "false" : "null");
+            case ErrorCode::INVALID_NUMBER:
+                return std::format("invalid number {}", text);
+            case ErrorCode::LEADING_ZEROS:
+                return "invalid number, leading zeros are not allowed";
+            case ErrorCode::NUMBER_OUT_OF_RANGE:
+                return "number out of range";
+            case ErrorCode::INVALID_STRING_CHARACTER:
+                return "invalid string character";
+            case ErrorCode::INVALID_ESCAPE:
+                return std::format("invalid escape character: \\{}", text);
+            case ErrorCode::INVALID_UNICODE_ESCAPE:
+                return "invalid unicode escape, expect 4 hex digits";
+            case ErrorCode::UNPAIRED_LOW_SURROGATE:
+                return "unpaired low surrogate in unicode escape";
+            case ErrorCode::UNPAIRED_HIGH_SURROGATE:
+                return "unpaired high surrogate in unicode escape";
+            case ErrorCode::UNTERMINATED_STRING:
+                return "unterminated string";
+            case ErrorCode::INVALID_VALUE:
+                return std::format("invalid token type: {}", token_name(found));
+            case ErrorCode::MISSING_COMMA_IN_ARRAY:
+                return "missing comma or right bracket when parsing array";
+            case ErrorCode::MISSING_COMMA_IN_OBJECT:
+                return "missing comma or right brace when parsing object";
+            case ErrorCode::KEY_NOT_STRING:
+                return "object key should be a string";
+            case ErrorCode::MISSING_COLON:
+                return "expect colon after key";
+            case ErrorCode::DUPLICATE_KEY:
+                return std::format("duplicate key {}", text);
+            case ErrorCode::TOO_DEEP:
+                return std::format("nesting is deeper than the maximum depth {}", max_depth);
+            case ErrorCode::TRAILING_CONTENT:
+                return std::format("unexpect token {}, expect {}", text, token_name(TokenType::END));
+        }
+        return "unknown error";
+    };
+    // lines are counted here, only when the message is wanted
+    auto [line, column] = locate(source, offset, origin);
+    return std::format("error: line {}, column {}: {}", line, column, detail());
+}
+
+auto neroll::Lexer::fail(ErrorCode code, std::size_t offset, std::string_view text) -> Token {
+    error_ = {code, offset, source(), origin_, text};
+    return {text, TokenType::ERROR, offset};
+}
+
 auto neroll::Lexer::parse_literal(std::string_view literal, TokenType type) -> Token {
     std::size_t len = 0;
     while (json_ < end_ && (std::isalnum(*json_) || *json_ == '_')) {
@@ -77,12 +314,9 @@ auto neroll::Lexer::parse_literal(std::string_view literal, TokenType type) -> T
         json_++;
     }
     std::string_view word(json_ - len, len);
-    if (word != literal) {
-        throw std::runtime_error(std::format("error: line {}, column {}: "
-            "unknow indentifier {}, do you mean '{}'?", lineno_, colno_, word, literal));
-    }
-    colno_ += literal.size();
-    return Token{word, type, lineno_, colno_};
+    if (word != literal)
+        return fail(ErrorCode::INVALID_LITERAL, offset() - len, word);
+    return Token{word, type, offset() - len};
 }
 
 auto neroll::Lexer::parse_true() -> Token {
@@ -98,217 +332,142 @@ auto neroll::Lexer::parse_null() -> Token {
 }
 
 auto neroll::Lexer::parse_number() -> Token {
-    int state = 0;
     const char *start_pos = json_;
-    bool complete = false;
-    while (json_ < end_) {
-        switch (state) {
-            case 0:
-                switch (*json_) {
-                    case '-':
-                        state = 2;
-                        break;
-                    case '0':
-                        state = 1;
-                        break;
-                    case '1':
-                    case '2':
-                    case '3':
-                    case '4':
-                    case '5':
-                    case '6':
-                    case '7':
-                    case '8':
-                    case '9':
-                        state = 3;
-                        break;
-                    default:
-                        throw std::runtime_error(std::format("error: line {}, column {}: "
-                            "invalid number {}", lineno_, colno_, std::string_view(start_pos, json_ - start_pos + 1)));
-                }
-                break;
-            case 1:
-                switch (*json_) {
-                    case '.':
-                        state = 4;
-                        break;
-                    default:
-                        complete = true;
-                        break;
-                        // throw std::runtime_error(std::format("error: line {}, column {}: "
-                        //     "invalid number {}", lineno_, colno_, std::string_view(start_pos, json_ - start_pos + 1)));
-                }
-                break;
-            case 2:
-                switch (*json_) {
-                    case '0':
-                        state = 1;
-                        break;
-                    case '1':
-                    case '2':
-                    case '3':
-                    case '4':
-                    case '5':
-                    case '6':
-                    case '7':
-                    case '8':
-                    case '9':
-                        state = 3;
-                        break;
-                    default:
-                        throw std::runtime_error(std::format("error: line {}, column {}: "
-                            "invalid number {}", lineno_, colno_, std::string_view(start_pos, json_ - start_pos + 1)));
-                }
-                break;
-            case 3:
-                switch (*json_) {
-                    case 'e':
-                    case 'E':
-                        state = 6;
-                        break;
-                    case '.':
-                        state = 4;
-                        break;
-                    case '0':
-                    case '1':
-                    case '2':
-                    case '3':
-                    case '4':
-                    case '5':
-                    case '6':
-                    case '7':
-                    case '8':
-                    case '9':
-                        break;
-                    default:
-                        complete = true;
-                        break;
-                        // throw std::runtime_error(std::format("error: line {}, column {}: "
-                        //     "invalid number {}", lineno_, colno_, std::string_view(start_pos, json_ - start_pos + 1)));
-                }
-                break;
-            case 4:
-                switch (*json_) {
-                    case '0':
-                    case '1':
-                    case '2':
-                    case '3':
-                    case '4':
-                    case '5':
-                    case '6':
-                    case '7':
-                    case '8':
-                    case '9':
-                        state = 5;
-                        break;
-                    default:
-                        throw std::runtime_error(std::format("error: line {}, column {}: "
-                            "invalid number {}", lineno_, colno_, std::string_view(start_pos, json_ - start_pos + 1)));
-                }
-                break;
-            case 5:
-                switch (*json_) {
-                    case '0':
-                    case '1':
-                    case '2':
-                    case '3':
-                    case '4':
-                    case '5':
-                    case '6':
-                    case '7':
-                    case '8':
-                    case '9':
-                        break;
-                    case 'e':
-                    case 'E':
-                        state = 6;
-                        break;
-                    default:
-                        complete = true;
-                        break;
-                        // throw std::runtime_error(std::format("error: line {}, column {}: "
-                        //     "invalid number {}", lineno_, colno_, std::string_view(start_pos, json_ - start_pos + 1)));
-                }
-                break;
-            case 6:
-                switch (*json_) {
-                    case '+':
-                    case '-':
-                        state = 7;
-                        break;
-                    case '0':
-                    case '1':
-                    case '2':
-                    case '3':
-                    case '4':
-                    case '5':
-                    case '6':
-                    case '7':
-                    case '8':
-                    case '9':
-                        state = 8;
-                        break;
-                    default:
-                        throw std::runtime_error(std::format("error: line {}, column {}: "
-                            "invalid number {}", lineno_, colno_, std::string_view(start_pos, json_ - start_pos + 1)));
-                }
-                break;
-            case 7:
-                switch (*json_) {
-                    case '0':
-                    case '1':
-                    case '2':
-                    case '3':
-                    case '4':
-                    case '5':
-                    case '6':
-                    case '7':
-                    case '8':
-                    case '9':
-                        state = 8;
-                        break;
-                    default:
-                        throw std::runtime_error(std::format("error: line {}, column {}: "
-                            "invalid number {}", lineno_, colno_, std::string_view(start_pos, json_ - start_pos + 1)));
-                }
-                break;
-            case 8:
-                switch (*json_) {
-                    case '0':
-                    case '1':
-                    case '2':
-                    case '3':
-                    case '4':
-                    case '5':
-                    case '6':
-                    case '7':
-                    case '8':
-                    case '9':
-                        break;
-                    default:
-                        complete = true;
-                        break;
-                        // throw std::runtime_error(std::format("error: line {}, column {}: "
-                        //     "invalid number {}", lineno_, colno_, std::string_view(start_pos, json_ - start_pos + 1)));
-                }
-                break;
-            default:
-                throw std::runtime_error(std::format("[fatal] error: line {}, column {}: "
-                            "invalid number {}", lineno_, colno_, std::string_view(start_pos, json_ - start_pos + 1)));
+    auto is_digit = [this] {
+        return json_ < end_ && *json_ >= '0' && *json_ <= '9';
+    };
+    auto invalid = [&] {
+        return fail(ErrorCode::INVALID_NUMBER, start_pos - begin_,
+            std::string_view(start_pos, std::min(json_ + 1, end_) - start_pos));
+    };
+
+    bool negative = *json_ == '-';
+    if (negative)
+        json_++;
+    if (!is_digit())
+        return invalid();
+
+    // the first 19 significant digits fit in the mantissa, the rest are
+    // dropped and only counted
+    std::uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    auto add_digit = [&] {
+        if (digits >= 19) {
+            digits++;
+            return false;
         }
-        if (complete)
-            break;
+        mantissa = mantissa * 10 + (*json_ - '0');
+        if (mantissa != 0)
+            digits++;
+        return true;
+    };
+
+    if (*json_ == '0') {
         json_++;
+        if (is_digit())
+            return fail(ErrorCode::LEADING_ZEROS, start_pos - begin_);
+    } else {
+        for (; is_digit(); json_++) {
+            if (!add_digit())
+                exponent++;
+        }
+    }
+
+    bool is_float = false;
+    if (json_ < end_ && *json_ == '.') {
+        is_float = true;
+        json_++;
+        if (!is_digit())
+            return invalid();
+        for (; is_digit(); json_++) {
+            if (add_digit())
+                exponent--;
+        }
     }
+    if (json_ < end_ && (*json_ == 'e' || *json_ == 'E')) {
+        is_float = true;
+        json_++;
+        bool negative_exponent = false;
+        if (json_ < end_ && (*json_ == '+' || *json_ == '-')) {
+            negative_exponent = *json_ == '-';
+            json_++;
+        }
+        if (!is_digit())
+            return invalid();
+        int explicit_exponent = 0;
+        for (; is_digit(); json_++) {
+            if (explicit_exponent < 100000)
+                explicit_exponent = explicit_exponent * 10 + (*json_ - '0');
+        }
+        exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
+    }
+
     std::string_view number_str = std::string_view(start_pos, json_ - start_pos);
-    colno_ += number_str.size();
-    return {number_str, neroll::TokenType::NUMBER, lineno_, colno_};
+    Token token{number_str, TokenType::NUMBER, static_cast<std::size_t>(start_pos - begin_)};
+    token.is_float = is_float;
+
+    if (!is_float) {
+        std::uint64_t limit = static_cast<std::uint64_t>(INT64_MAX) + (negative ? 1 : 0);
+        if (digits > 19 || mantissa > limit)
+            return fail(ErrorCode::NUMBER_OUT_OF_RANGE, token.offset);
+        token.integer = negative ? static_cast<int64_t>(0 - mantissa) : static_cast<int64_t>(mantissa);
+        return token;
+    }
+
+    // with dropped digits the value lies between mantissa and mantissa + 1,
+    // if both round to the same double that is the answer
+    bool exact = to_double(mantissa, exponent, negative, token.floating);
+    if (exact && digits > 19) {
+        double upper;
+        exact = to_double(mantissa + 1, exponent, negative, upper) && upper == token.floating;
+    }
+    if (!exact) {
+        auto [ptr, errc] = std::from_chars(number_str.data(), number_str.data() + number_str.size(), token.floating);
+        if (errc == std::errc::result_out_of_range)
+            return fail(ErrorCode::NUMBER_OUT_OF_RANGE, token.offset);
+    }
+    if (std::isinf(token.floating) || (token.floating == 0 && mantissa != 0))
+        return fail(ErrorCode::NUMBER_OUT_OF_RANGE, token.offset);
+    return token;
+}
+
+// the error of an invalid escape, its offset is that of the backslash
+auto neroll::Lexer::parse_unicode_escape() -> ErrorCode {
+    // json_ points at the 'u' of \uXXXX
+    int code = read_hex4(json_ + 1);
+    if (code < 0)
+        return ErrorCode::INVALID_UNICODE_ESCAPE;
+    if (code >= 0xDC00 && code <= 0xDFFF)
+        return ErrorCode::UNPAIRED_LOW_SURROGATE;
+    if (code >= 0xD800 && code <= 0xDBFF) {
+        int low = end_ - json_ > 6 && json_[5] == '\\' && json_[6] == 'u' ? read_hex4(json_ + 7) : -1;
+        if (low < 0xDC00 || low > 0xDFFF)
+            return ErrorCode::UNPAIRED_HIGH_SURROGATE;
+        json_ += 6;
+    }
+    json_ += 4;
+    return ErrorCode::NONE;
+}
+
+auto neroll::Lexer::read_hex4(const char *pos) const -> int {
+    if (end_ - pos < 4)
+        return -1;
+    int code = 0;
+    for (int i = 0; i < 4; i++) {
+        int digit = hex_digit(pos[i]);
+        if (digit < 0)
+            return -1;
+        code = code * 16 + digit;
+    }
+    return code;
 }
 
 auto neroll::Lexer::parse_string() -> Token {
     int state = 0;
     const char *start_pos = json_;
     bool complete = false;
+    bool escaped = false;
     while (json_ < end_) {
         switch (state) {
             case 0:
@@ -317,26 +476,24 @@ auto neroll::Lexer::parse_string() -> Token {
                         state = 1;
                         break;
                     default:
-                        throw std::runtime_error(std::format("error: line {}, column {}: "
-                            "string should begin with \"", lineno_, colno_));
+                        return fail(ErrorCode::INVALID_TOKEN, offset());
                 }
                 break;
             case 1:
                 switch (*json_) {
                     case '\\':
                         state = 2;
+                        escaped = true;
+                        with_stats(stats_, [](auto &stats) {
+                            stats.escapes++;
+                        });
                         break;
                     case '\"':
                         state = 3;
                         break;
-                    // case '\n':
-                    //     throw std::runtime_error(std::format("error: line {}, column {}: "
-                    //         "string cannot contain \\n", lineno_, colno_));
                     default:
-                        if (*json_ < 20) {
-                            throw std::runtime_error(std::format("error: line {}, column {}: "
-                                "invalid string character", lineno_, colno_));
-                        }
+                        if (static_cast<unsigned char>(*json_) < 0x20)
+                            return fail(ErrorCode::INVALID_STRING_CHARACTER, offset());
                         break;
                 }
                 break;
@@ -353,40 +510,218 @@ auto neroll::Lexer::parse_string() -> Token {
                         state = 1;
                         break;
                     case 'u':
-                        throw std::runtime_error("unicode not support yet");
+                        if (auto code = parse_unicode_escape(); code != ErrorCode::NONE)
+                            return fail(code, offset() - 1);
+                        state = 1;
+                        break;
                     default:
-                        throw std::runtime_error(std::format("invalid escape character: \\{}", *json_));
+                        return fail(ErrorCode::INVALID_ESCAPE, offset(), {json_, 1});
                 }
                 break;
             case 3:
                 complete = true;
                 break;
-            default:
-                throw std::runtime_error("switch error, this should not happen");
         }
         if (complete)
             break;
         json_++;
-        colno_++;
     }
+    if (state != 3)
+        return fail(ErrorCode::UNTERMINATED_STRING, start_pos - begin_);
     auto string = std::string_view(start_pos, json_ - start_pos);
-    return {string, TokenType::STRING, lineno_, colno_};
+    return {string, TokenType::STRING, static_cast<std::size_t>(start_pos - begin_), escaped};
 }
 
 auto neroll::Lexer::match(const char *ch, TokenType type) -> Token {
-    if (*json_ != *ch) {
-        throw std::runtime_error(std::format("error: line {}, column {}:"
-            "expect {}, get {}", lineno_, colno_, ch, *json_));
-    }
+    if (*json_ != *ch)
+        return fail(ErrorCode::INVALID_TOKEN, offset());
     json_++;
-    colno_++;
-    return {ch, type, lineno_, colno_};
+    return {ch, type, offset() - 1};
+}
+
+void neroll::Lexer::reset(std::string_view json) {
+    begin_ = json_ = json.data();
+    end_ = json.data() + json.size();
+    indexed_ = false;
+    index_.begin = index_.end = 0;
+    index_.count = 0;
+    index_.positions.clear();
+    index_.string_breaks.clear();
+    next_structural_ = 0;
+    origin_ = {1, 1};
 }
 
 auto neroll::Lexer::next_token() -> Token {
+    auto token = try_next_token();
+    if (token.type == TokenType::ERROR) [[unlikely]]
+        throw_exception(std::runtime_error(error_.message()));
+    return token;
+}
+
+auto neroll::Lexer::try_next_token() -> Token {
+    if constexpr (!STATS_ENABLED) {
+        return lex_token();
+    } else {
+        auto start = std::chrono::steady_clock::now();
+        auto token = lex_token();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        with_stats(stats_, [&](auto &stats) {
+            stats.lex_time += elapsed;
+            stats.tokens[static_cast<std::size_t>(token.type)]++;
+            if (token.type == TokenType::NUMBER)
+                (token.is_float ? stats.floats : stats.integers)++;
+        });
+        return token;
+    }
+}
+
+auto neroll::Lexer::stats() const -> Stats {
+    Stats stats;
+    with_stats(stats_, [&](const auto &own) {
+        stats = own;
+    });
+    return stats;
+}
+
+auto neroll::Lexer::lex_token() -> Token {
+    if (indexed_)
+        return next_indexed_token();
     parse_white();
+    return lex_here();
+}
+
+// Every token starts at an indexed position, the whitespace before it is
+// jumped over. Bytes the index does not know about can only follow the
+// previous token directly, like the x of 1x, and are lexed as usual.
+auto neroll::Lexer::next_indexed_token() -> Token {
+    const auto &positions = index_.positions;
+    std::size_t start = offset();
+    while (next_structural_ < index_.count && positions[next_structural_] < start)
+        next_structural_++;
+    // the window is used up, the next one starts here; only a window of
+    // whitespace has no positions
+    if (next_structural_ == index_.count && index_.end < source().size()) {
+        index_from(start);
+        while (index_.count == 0 && index_.end < source().size())
+            index_from(index_.end);
+    }
+    if (next_structural_ == index_.count || positions[next_structural_] != start) {
+        if (json_ < end_ && *json_ != ' ' && *json_ != '\t' && *json_ != '\r' && *json_ != '\n')
+            return lex_here();
+        if (next_structural_ == index_.count) {
+            json_ = end_;
+            return {"EOF", TokenType::END, offset()};
+        }
+        start = positions[next_structural_];
+        json_ = begin_ + start;
+    }
+    next_structural_++;
+
+    switch (*json_) {
+        case '{':
+            json_++;
+            return {"{", TokenType::LBRACE, start};
+        case '}':
+            json_++;
+            return {"}", TokenType::RBRACE, start};
+        case '[':
+            json_++;
+            return {"[", TokenType::LBRACKET, start};
+        case ']':
+            json_++;
+            return {"]", TokenType::RBRACKET, start};
+        case ',':
+            json_++;
+            return {",", TokenType::COMMA, start};
+        case ':':
+            json_++;
+            return {":", TokenType::COLON, start};
+        case '\"':
+            return lex_indexed_string(start);
+        case 't':
+            return parse_true();
+        case 'f':
+            return parse_false();
+        case 'n':
+            return parse_null();
+        case '0':
+        case '1':
+        case '2':
+        case '3':
+        case '4':
+        case '5':
+        case '6':
+        case '7':
+        case '8':
+        case '9':
+        case '-':
+            return parse_number();
+        default:
+            return lex_here();
+    }
+}
+
+// The string runs up to the next position, less whitespace. If it ends with
+// a quote and every break in between is a valid escape sequence, that
+// quote closes it, and only the breaks were looked at. Anything else is
+// left to parse_string(), which also reports the error.
+auto neroll::Lexer::lex_indexed_string(std::size_t start) -> Token {
+    const auto &positions = index_.positions;
+    if (next_structural_ == index_.count && index_.end < source().size()) {
+        // the string goes on past the window, the next one starts with it;
+        // a string longer than a window is lexed as usual
+        index_from(start);
+        next_structural_ = 1;
+        if (index_.count == 1 && index_.end < source().size())
+            return parse_string();
+    }
+    std::size_t end = next_structural_ < index_.count ? positions[next_structural_] : index_.end;
+    while (end > start + 1 && (begin_[end - 1] == ' ' || begin_[end - 1] == '\t'
+            || begin_[end - 1] == '\r' || begin_[end - 1] == '\n'))
+        end--;
+    if (end < start + 2 || begin_[end - 1] != '\"')
+        return parse_string();
+
+    auto close = end - 1;
+    std::size_t escapes = 0;
+    for (auto i = index_.next_break(start + 1, close); i < close; i = index_.next_break(i, close)) {
+        if (begin_[i] != '\\' || i + 1 >= close)
+            return parse_string();
+        escapes++;
+        switch (begin_[i + 1]) {
+            case '\\':
+            case '/':
+            case 'b':
+            case 'f':
+            case 'r':
+            case 'n':
+            case 't':
+            case '\"':
+                i += 2;
+                break;
+            case 'u': {
+                json_ = begin_ + i + 1;
+                auto code = parse_unicode_escape();
+                i = offset() + 1;
+                json_ = begin_ + start;
+                if (code != ErrorCode::NONE || i > close)
+                    return parse_string();
+                break;
+            }
+            default:
+                return parse_string();
+        }
+    }
+    with_stats(stats_, [&](auto &stats) {
+        stats.escapes += escapes;
+    });
+    json_ = begin_ + end;
+    return {{begin_ + start, end - start}, TokenType::STRING, start, escapes != 0};
+}
+
+auto neroll::Lexer::lex_here() -> Token {
     if (json_ >= end_)
-        return {"EOF", TokenType::END, lineno_, colno_};
+        return {"EOF", TokenType::END, offset()};
     switch (*json_) {
         case 't':
             return parse_true();
@@ -421,234 +756,533 @@ auto neroll::Lexer::next_token() -> Token {
         case '-':
             return parse_number();
         default:
-            throw std::runtime_error(std::format("error: line {}, column {}: invalid token", lineno_, colno_));
+            return fail(ErrorCode::INVALID_TOKEN, offset());
     }
 }
 
-void neroll::Parser::throw_error(std::string_view message, const Token &token) {
-    auto line = token.lineno;
-    auto column = token.colno;
-    throw std::runtime_error(std::format("error: line {}, column {}: {}", line, column, message));
+struct neroll::Document::KeyIndexes {
+    std::shared_mutex mutex;
+    // object slot to an open addressing table of key slots, 0 marks a
+    // free entry
+    std::unordered_map<std::size_t, std::vector<std::size_t>> tables;
+};
+
+neroll::Document::Document(std::string_view source) : source_(source) {}
+
+auto neroll::Document::view(std::span<const std::uint64_t> tape, std::string_view strings,
+        std::shared_ptr<const MappedFile> file) -> Document {
+    Document document;
+    document.file_ = std::move(file);
+    document.mapped_tape_ = tape.data();
+    document.mapped_tape_size_ = tape.size();
+    document.mapped_strings_ = strings;
+    document.enable_key_indexes();
+    return document;
 }
 
-auto neroll::Parser::parse() -> std::shared_ptr<AstNode> {
-    switch (current_token_.type) {
-        case TokenType::LBRACE:
-            return parse_object();
-        case TokenType::LBRACKET:
-            return parse_array();
-        case TokenType::STRING:
-            return std::make_shared<StringNode>(current_token_.content.substr(1, current_token_.content.size() - 2));
-        case TokenType::NUMBER:
-            return match(current_token_);
-        case TokenType::TRUE:
-        case TokenType::FALSE:
-            return match(current_token_);
-        case TokenType::NIL:
-            return match(current_token_);
+void neroll::static_json_error(std::size_t offset, const char *message) {
+    throw_exception(std::runtime_error(std::format("error: offset {}: {}", offset, message)));
+}
+
+void neroll::Document::enable_key_indexes() {
+    if (!key_indexes_)
+        key_indexes_ = std::make_unique<KeyIndexes>();
+}
+
+neroll::Document::~Document() = default;
+
+void neroll::Document::clear(std::string_view source) {
+    source_ = source;
+    tape_.clear();
+    strings_.clear();
+    if (key_indexes_)
+        key_indexes_->tables.clear();
+    file_.reset();
+    mapped_tape_ = nullptr;
+    mapped_tape_size_ = 0;
+    mapped_strings_ = {};
+}
+
+neroll::Document::Document(Document &&) noexcept = default;
+
+auto neroll::Document::operator=(Document &&) noexcept -> Document & = default;
+
+auto neroll::Document::find_key(std::size_t index, std::string_view key) const -> std::size_t {
+    auto end = index + payload_at(index);
+    if (slot_at(index + 1) < HASH_INDEX_THRESHOLD || !key_indexes_) {
+        for (auto i = index + 2; i < end; i = next_index(i + 2)) {
+            if (string_at(i) == key)
+                return i;
+        }
+        return 0;
+    }
+
+    auto probe = [&](const std::vector<std::size_t> &table) -> std::size_t {
+        auto mask = table.size() - 1;
+        for (auto i = std::hash<std::string_view>{}(key) & mask; table[i] != 0; i = (i + 1) & mask) {
+            if (string_at(table[i]) == key)
+                return table[i];
+        }
+        return 0;
+    };
+
+    {
+        std::shared_lock lock(key_indexes_->mutex);
+        auto it = key_indexes_->tables.find(index);
+        if (it != key_indexes_->tables.end())
+            return probe(it->second);
+    }
+
+    // keys are inserted in document order, so with duplicate keys the
+    // first one is always reached first
+    std::unique_lock lock(key_indexes_->mutex);
+    auto &table = key_indexes_->tables[index];
+    if (table.empty()) {
+        table.resize(std::bit_ceil(slot_at(index + 1) * 2));
+        auto mask = table.size() - 1;
+        for (auto i = index + 2; i < end; i = next_index(i + 2)) {
+            auto entry = std::hash<std::string_view>{}(string_at(i)) & mask;
+            while (table[entry] != 0)
+                entry = (entry + 1) & mask;
+            table[entry] = i;
+        }
+    }
+    return probe(table);
+}
+
+auto neroll::Document::next_index(std::size_t index) const -> std::size_t {
+    switch (type_at(index)) {
+        case AstType::INT:
+        case AstType::FLOAT:
+        case AstType::STRING:
+            return index + 2;
+        case AstType::BOOLEAN:
+        case AstType::NIL:
+            return index + 1;
+        case AstType::ARRAY:
+        case AstType::OBJECT:
+            return index + payload_at(index);
         default:
-            throw std::runtime_error(std::format("parse: invalid token type: {}", token_name(current_token_.type)));
+            throw_exception(std::runtime_error("invalid ast node type"));
     }
 }
 
-auto neroll::Parser::match(const Token &token) -> std::shared_ptr<AstNode> {
-    switch (token.type) {
-        case TokenType::TRUE:
-            return std::make_shared<BooleanNode>(true);
-        case TokenType::FALSE:
-            return std::make_shared<BooleanNode>(false);
-        case TokenType::NIL:
-            return std::make_shared<NullNode>();
-        case TokenType::STRING:
-            return std::make_shared<StringNode>(std::string{token.content});
-        case TokenType::NUMBER: {
-            int is_float = std::ranges::any_of(token.content, [](char  ch) {
-                return ch == '.' || ch == 'e' || ch == 'E';
-            });
-            if (is_float) {
-                double value;
-                auto [ptr, errc] = std::from_chars(token.content.data(),
-                    token.content.data() + token.content.size(), value);
-                if (errc == std::errc::invalid_argument)
-                    throw_error("invalid number", token);
-                if (errc == std::errc::result_out_of_range)
-                    throw_error("number out of range", token);
-                return std::make_shared<FloatNode>(value);
-            } else {
-                int64_t value;
-                auto [ptr, errc] = std::from_chars(token.content.data(),
-                    token.content.data() + token.content.size(), value);
-                if (errc == std::errc::invalid_argument)
-                    throw_error("invalid number", token);
-                if (errc == std::errc::result_out_of_range)
-                    throw_error("number out of range", token);
-                return std::make_shared<IntNode>(value);
-            }
+void neroll::DocumentBuilder::append(AstType type, std::uint64_t payload) {
+    document_.tape_.push_back((static_cast<std::uint64_t>(type) << Document::TAG_SHIFT) | payload);
+}
+
+void neroll::DocumentBuilder::append_string(std::string_view value) {
+    auto source = document_.source_;
+    std::less_equal<const char *> before;
+    if (!source.empty() && before(source.data(), value.data())
+            && before(value.data() + value.size(), source.data() + source.size())) {
+        append(AstType::STRING, Document::SOURCE_STRING | static_cast<std::uint64_t>(value.data() - source.data()));
+        document_.tape_.push_back(value.size());
+        return;
+    }
+    append(AstType::STRING, document_.strings_.size());
+    document_.tape_.push_back(value.size());
+    document_.strings_.append(value);
+}
+
+void neroll::DocumentBuilder::finish_value() {
+    if (open_.empty())
+        return;
+    if (discard_ && discard_->depth == open_.size()) {
+        document_.tape_.resize(discard_->tape_size);
+        document_.strings_.resize(discard_->strings_size);
+        discard_.reset();
+        return;
+    }
+    open_.back().count++;
+}
+
+void neroll::DocumentBuilder::start_container(AstType type) {
+    open_.push_back({document_.tape_.size(), 0, keys_.size(), dead_.size(), nullptr});
+    append(type, 0);
+    document_.tape_.push_back(0);
+}
+
+void neroll::DocumentBuilder::end_container() {
+    auto &container = open_.back();
+    if (dead_.size() > container.dead_begin)
+        remove_dead_members(container);
+    auto index = container.index;
+    document_.tape_[index] |= document_.tape_.size() - index;
+    document_.tape_[index + 1] = container.count;
+    // created up front so that concurrent lookups only share the mutex
+    if (document_.type_at(index) == AstType::OBJECT && container.count >= Document::HASH_INDEX_THRESHOLD)
+        document_.enable_key_indexes();
+    keys_.resize(container.keys_begin);
+    open_.pop_back();
+    finish_value();
+}
+
+void neroll::DocumentBuilder::on_start_object() {
+    start_container(AstType::OBJECT);
+}
+
+void neroll::DocumentBuilder::on_end_object() {
+    end_container();
+}
+
+void neroll::DocumentBuilder::on_start_array() {
+    start_container(AstType::ARRAY);
+}
+
+void neroll::DocumentBuilder::on_end_array() {
+    end_container();
+}
+
+auto neroll::DocumentBuilder::find_open_key(Container &object, std::string_view key) -> std::size_t * {
+    if (object.key_hashes) {
+        auto [first, last] = object.key_hashes->equal_range(std::hash<std::string_view>{}(key));
+        for (auto it = first; it != last; ++it) {
+            if (document_.string_at(keys_[it->second]) == key)
+                return &keys_[it->second];
         }
-        default:
-            throw std::runtime_error("invalid token type");
+        return nullptr;
+    }
+    for (auto i = object.keys_begin; i < keys_.size(); i++) {
+        if (document_.string_at(keys_[i]) == key)
+            return &keys_[i];
     }
     return nullptr;
 }
 
-void neroll::Parser::expect(TokenType expect_type) {
-    if (current_token_.type != expect_type)
-        throw_error(std::format("unexpect token {}, expect {}",
-            current_token_.content, token_name(expect_type)), current_token_);
+void neroll::DocumentBuilder::remember_key(Container &object, std::size_t slot, std::size_t hash) {
+    keys_.push_back(slot);
+    if (object.key_hashes) {
+        object.key_hashes->emplace(hash, keys_.size() - 1);
+    } else if (keys_.size() - object.keys_begin >= Document::HASH_INDEX_THRESHOLD) {
+        object.key_hashes = std::make_unique<std::unordered_multimap<std::size_t, std::size_t>>();
+        for (auto i = object.keys_begin; i < keys_.size(); i++)
+            object.key_hashes->emplace(std::hash<std::string_view>{}(document_.string_at(keys_[i])), i);
+    }
 }
 
-auto neroll::Parser::parse_array() -> std::shared_ptr<AstNode> {
-    move();
-    auto array = std::make_shared<ArrayNode>();
-    if (current_token_.type == TokenType::RBRACKET)
-        return array;
-    while (true) {
-        std::shared_ptr<AstNode> value = parse();
-        array->push_back(value);
-        move();
+void neroll::DocumentBuilder::remove_dead_members(Container &object) {
+    auto first_dead = dead_.begin() + object.dead_begin;
+    std::sort(first_dead, dead_.end());
 
-        if (current_token_.type == TokenType::COMMA) {
-            move();
-        } else if (current_token_.type == TokenType::RBRACKET) {
-            return array;
+    auto &tape = document_.tape_;
+    auto write = object.index + 2;
+    auto read = write;
+    while (read < tape.size()) {
+        auto member_end = document_.next_index(read + 2);
+        if (first_dead != dead_.end() && *first_dead == read) {
+            ++first_dead;
         } else {
-            throw_error("missing comma or right bracket when parsing array", current_token_);
+            std::copy(tape.begin() + read, tape.begin() + member_end, tape.begin() + write);
+            write += member_end - read;
         }
+        read = member_end;
     }
-    return array;
-}
-
-auto neroll::Parser::parse_object() -> std::shared_ptr<AstNode> {
-    move();
-    auto object = std::make_shared<ObjectNode>();
-    if (current_token_.type == TokenType::RBRACE)
-        return object;
-    while (true) {
-        auto key_node = parse();
-        if (key_node->type() != AstType::STRING)
-            throw_error("object key should be a string", current_token_);
-        auto key = std::static_pointer_cast<StringNode>(key_node)->value();
-        move();
-        if (current_token_.type != TokenType::COLON)
-            throw_error("expect colon after key", current_token_);
-        move();
-        
-        auto value = parse();
-        object->insert({key, value});
-
-        move();
-        if (current_token_.type == TokenType::COMMA) {
-            move();
-        } else if (current_token_.type == TokenType::RBRACE) {
-            return object;
-        } else {
-            throw_error("missing comma or right brace when parsing object", current_token_);
-        }
+    tape.resize(write);
+    object.count -= dead_.size() - object.dead_begin;
+    dead_.resize(object.dead_begin);
+}
+
+bool neroll::DocumentBuilder::on_key(std::string_view key) {
+    if (duplicate_keys_ == DuplicateKeys::KEEP_ALL || discard_) {
+        append_string(key);
+        return true;
     }
+
+    auto &object = open_.back();
+    auto slot = document_.tape_.size();
+    auto *existing = find_open_key(object, key);
+    if (existing && duplicate_keys_ == DuplicateKeys::ERROR)
+        return false;
+    if (existing && duplicate_keys_ == DuplicateKeys::KEEP_FIRST)
+        discard_ = Discard{open_.size(), slot, document_.strings_.size()};
+
+    append_string(key);
+    if (!existing) {
+        remember_key(object, slot, std::hash<std::string_view>{}(key));
+    } else if (duplicate_keys_ == DuplicateKeys::KEEP_LAST) {
+        dead_.push_back(*existing);
+        *existing = slot;
+    }
+    return true;
+}
+
+void neroll::DocumentBuilder::on_string(std::string_view value) {
+    append_string(value);
+    finish_value();
+}
+
+void neroll::DocumentBuilder::on_int(int64_t value) {
+    append(AstType::INT, 0);
+    document_.tape_.push_back(std::bit_cast<std::uint64_t>(value));
+    finish_value();
 }
 
-auto neroll::ArrayNode::operator[](std::size_t index) -> std::shared_ptr<AstNode> & {
-    return value_[index];
+void neroll::DocumentBuilder::on_double(double value) {
+    append(AstType::FLOAT, 0);
+    document_.tape_.push_back(std::bit_cast<std::uint64_t>(value));
+    finish_value();
 }
 
-void neroll::Stringifier::load_config() {
-    std::ifstream fin("config.json");
-    std::ostringstream sout;
-    sout << fin.rdbuf();
-    config_ast_ = Parser(Lexer{sout.str()}).parse();
+void neroll::DocumentBuilder::on_bool(bool value) {
+    append(AstType::BOOLEAN, value ? 1 : 0);
+    finish_value();
+}
+
+void neroll::DocumentBuilder::on_null() {
+    append(AstType::NIL, 0);
+    finish_value();
+}
 
-    auto object = std::static_pointer_cast<ObjectNode>(config_ast_);
+void neroll::DocumentBuilder::reset() {
+    open_.clear();
+    keys_.clear();
+    dead_.clear();
+    discard_.reset();
+}
 
-    auto number_node = object->at(R"(number-color)");
-    number_color_ = std::static_pointer_cast<StringNode>(number_node)->value();
+bool neroll::Parser::fail(ErrorCode code, const Token &token) {
+    if (token.type == TokenType::ERROR)
+        error_ = lexer_.error();
+    else
+        error_ = {code, token.offset, lexer_.source(), lexer_.origin(), token.content, token.type, options_.max_depth};
+    return false;
+}
 
-    auto string_node = object->at(R"(string-color)");
-    string_color_ = std::static_pointer_cast<StringNode>(string_node)->value();
+void neroll::Parser::throw_error() const {
+    throw_exception(std::runtime_error(error_.message()));
+}
 
-    auto bool_node = object->at(R"(bool-color)");
-    bool_color_ = std::static_pointer_cast<StringNode>(bool_node)->value();
+auto neroll::Parser::parse() -> Document {
+    auto result = try_parse();
+    if (!result)
+        throw_error();
+    return std::move(result).value();
+}
 
-    auto null_node = object->at(R"(null-color)");
-    null_color_ = std::static_pointer_cast<StringNode>(null_node)->value();
+auto neroll::Parser::try_parse() -> ParseResult {
+    Document document(lexer_.source());
+    DocumentBuilder builder(document, options_.duplicate_keys);
+    if (!try_parse(builder))
+        return error_;
+    with_stats(stats_, [&](auto &stats) {
+        stats.bytes_allocated += document.memory_usage();
+    });
+    return document;
+}
 
-    auto brace_node = object->at(R"(brace-color)");
-    brace_color_ = std::static_pointer_cast<StringNode>(brace_node)->value();
+neroll::ReusableParser::ReusableParser(ParseOptions options)
+    : options_(options), builder_(std::in_place, document_, options.duplicate_keys),
+      parser_(Lexer{std::string_view{}}, options) {}
 
-    auto bracket_node = object->at(R"(bracket-color)");
-    bracket_color_ = std::static_pointer_cast<StringNode>(bracket_node)->value();
+auto neroll::ReusableParser::parse(std::string_view json) -> const Document & {
+    auto document = try_parse(json);
+    if (!document)
+        throw_exception(std::runtime_error(error().message()));
+    return *document;
+}
 
+auto neroll::ReusableParser::try_parse(std::string_view json, Location origin) -> const Document * {
+    document_.clear(json);
+    builder_->reset();
+    parser_.reset(json, origin);
+    bool ok = parser_.try_parse(*builder_);
+    high_water_mark_ = std::max(high_water_mark_, memory_usage());
+    return ok ? &document_ : nullptr;
 }
 
-std::string neroll::Stringifier::to_html_traverse(const std::shared_ptr<AstNode> &root, int layer) const {
-    switch (root->type()) {
+void neroll::ReusableParser::trim(std::size_t limit) {
+    if (memory_usage() <= limit)
+        return;
+    document_ = Document{};
+    builder_.emplace(document_, options_.duplicate_keys);
+    parser_ = Parser(Lexer{std::string_view{}}, options_);
+    high_water_mark_ = 0;
+}
+
+auto neroll::Parser::stats() const -> Stats {
+    auto stats = lexer_.stats();
+    with_stats(stats_, [&](const auto &own) {
+        stats.max_depth = own.max_depth;
+        stats.nodes = own.nodes;
+        stats.bytes_allocated = own.bytes_allocated;
+        stats.build_time = own.build_time;
+    });
+    return stats;
+}
+
+bool neroll::Parser::push_container(TokenType type) {
+    if (stack_.size() >= options_.max_depth)
+        return fail(ErrorCode::TOO_DEEP, current_token_);
+    stack_.push_back(type);
+    with_stats(stats_, [&](auto &stats) {
+        stats.max_depth = std::max(stats.max_depth, stack_.size());
+    });
+    return true;
+}
+
+auto neroll::ArrayNode::operator[](std::size_t index) const -> AstNode {
+    auto it = begin();
+    for (std::size_t i = 0; i < index; i++)
+        ++it;
+    return *it;
+}
+
+auto neroll::ObjectNode::at(std::string_view key) const -> AstNode {
+    auto slot = document_->find_key(index_, key);
+    if (slot == 0)
+        throw_exception(std::out_of_range(std::format("key {} not found", key)));
+    return {document_, slot + 2};
+}
+
+auto neroll::ObjectNode::find(std::string_view key) const -> iterator {
+    auto slot = document_->find_key(index_, key);
+    return slot == 0 ? end() : iterator{document_, slot};
+}
+
+void neroll::Stringifier::write_string(Sink &sink, std::string_view value) {
+    sink.put('"');
+    // runs of characters that need no escaping are written in one piece
+    std::size_t plain = 0;
+    for (std::size_t i = 0; i < value.size(); i++) {
+        std::string_view escaped;
+        char unicode[6] = {'\\', 'u', '0', '0'};
+        switch (value[i]) {
+            case '"':
+                escaped = R"(\")";
+                break;
+            case '\\':
+                escaped = R"(\\)";
+                break;
+            case '\n':
+                escaped = R"(\n)";
+                break;
+            case '\r':
+                escaped = R"(\r)";
+                break;
+            case '\t':
+                escaped = R"(\t)";
+                break;
+            case '<':
+                escaped = "&lt;";
+                break;
+            case '>':
+                escaped = "&gt;";
+                break;
+            case '&':
+                escaped = "&amp;";
+                break;
+            default:
+                if (static_cast<unsigned char>(value[i]) >= 0x20)
+                    continue;
+                unicode[4] = "0123456789abcdef"[value[i] >> 4];
+                unicode[5] = "0123456789abcdef"[value[i] & 0xf];
+                escaped = {unicode, sizeof(unicode)};
+                break;
+        }
+        sink.write(value.substr(plain, i - plain));
+        sink.write(escaped);
+        plain = i + 1;
+    }
+    sink.write(value.substr(plain));
+    sink.put('"');
+}
+
+void neroll::Stringifier::indent(Sink &sink, int layer) {
+    for (int i = 0; i < layer; i++)
+        sink.write("&nbsp;&nbsp;&nbsp;&nbsp;");
+}
+
+void neroll::Stringifier::to_html_value(AstNode node, int layer, Sink &sink) {
+    // integers take at most 20 characters, shortest doubles at most 24
+    char number[32];
+    switch (node.type()) {
         case AstType::INT: {
-            auto number = std::static_pointer_cast<IntNode>(root)->value();
-            return std::format(R"(<span style="color: {}">{}</span>)", number_color_, number);
+            auto end = std::to_chars(number, number + sizeof(number), IntNode(node).value()).ptr;
+            sink.write(theme_->number_open());
+            sink.write({number, static_cast<std::size_t>(end - number)});
+            sink.write("</span>");
         }
         break;
         case AstType::FLOAT: {
-            auto number = std::static_pointer_cast<FloatNode>(root)->value();
-            return std::format(R"(<span style="color: {}">{}</span>)", number_color_, number);
-        }
-        break;
-        case AstType::BOOLEAN: {
-            auto boolean = std::static_pointer_cast<BooleanNode>(root)->value();
-            return std::format(R"(<span style="color: {}">{}</span>)", bool_color_, boolean);
-        }
-        break;
-        case AstType::NIL: {
-            return std::format(R"(<span style="color: {}">{}</span>)", null_color_, "null");
-        }
-        break;
-        case AstType::STRING: {
-            std::string string = std::static_pointer_cast<StringNode>(root)->value();
-            return std::format(R"(<span style="color: {}">"{}"</span>)", string_color_, string);
+            auto end = std::to_chars(number, number + sizeof(number), FloatNode(node).value()).ptr;
+            sink.write(theme_->number_open());
+            sink.write({number, static_cast<std::size_t>(end - number)});
+            sink.write("</span>");
         }
         break;
+        case AstType::BOOLEAN:
+            sink.write(theme_->bool_open());
+            sink.write(BooleanNode(node).value() ? "true" : "false");
+            sink.write("</span>");
+            break;
+        case AstType::NIL:
+            sink.write(theme_->null_span());
+            break;
+        case AstType::STRING:
+            sink.write(theme_->string_open());
+            write_string(sink, StringNode(node).value());
+            sink.write("</span>");
+            break;
         case AstType::ARRAY: {
-            auto array = std::static_pointer_cast<ArrayNode>(root);
-            std::string html = std::format(R"(<span style="color: {0}">[</span>)", bracket_color_);
-            for (std::size_t i = 0; i < array->size(); i++) {
-                if (i != 0) {
-                    html.append(", ");
-                }
-                html.append(to_html_traverse(array->operator[](i), layer));
-            }
-            html.append(std::format(R"(<span style="color: {}">]</span>)", bracket_color_));
-            return html;
+            ArrayNode array(node);
+            sink.write(theme_->array_open());
+            stack_.push_back({AstType::ARRAY, layer, array.begin(), array.end(), {}, {}});
         }
         break;
         case AstType::OBJECT: {
-            auto object = std::static_pointer_cast<ObjectNode>(root);
-            std::string html = std::format(R"(<span style="color: {0}">{{</span>)", brace_color_);
-            const auto map = object->value();
-            int index = 0;
-            for (const auto &[key, value_node] : map) {
-                if (index != 0)
-                    html.append(",");
-                html.append("<br/>");
-                for (int i = 0; i < layer; i++)
-                    html.append("&nbsp;&nbsp;&nbsp;&nbsp;");
-                html.append(std::format(R"(<span style="color: {}">"{}"</span>)", string_color_, key));
-                html.append(": ");
-                html.append(to_html_traverse(value_node, layer + 1));
-                index++;
-            }
-            std::string space;
-            for (int i = 0; i < layer - 1; i++) {
-                space.append("&nbsp;&nbsp;&nbsp;&nbsp;");
-            }
-            html.append(std::format(R"(<span style="color: {}"><br/>{}}}</span>)", brace_color_, space));
-            return html;
+            ObjectNode object(node);
+            sink.write(theme_->object_open());
+            stack_.push_back({AstType::OBJECT, layer, {}, {}, object.begin(), object.end()});
         }
         break;
         default:
-            throw std::runtime_error("invalid ast node type");
+            throw_exception(std::runtime_error("invalid ast node type"));
+    }
+}
+
+// Walks the tree with an explicit stack of open containers, so that deep
+// documents can not overflow the call stack.
+void neroll::Stringifier::to_html_traverse(AstNode root, int layer, Sink &sink) {
+    stack_.clear();
+    to_html_value(root, layer, sink);
+    while (!stack_.empty()) {
+        auto &frame = stack_.back();
+        if (frame.type == AstType::ARRAY) {
+            if (frame.element == frame.elements_end) {
+                sink.write(theme_->array_close());
+                stack_.pop_back();
+                continue;
+            }
+            auto element = *frame.element;
+            if (frame.count++ != 0)
+                sink.write(", ");
+            ++frame.element;
+            to_html_value(element, frame.layer, sink);
+        } else {
+            if (frame.member == frame.members_end) {
+                sink.write(theme_->object_close_begin());
+                indent(sink, frame.layer - 1);
+                sink.write("}</span>");
+                stack_.pop_back();
+                continue;
+            }
+            auto [key, value_node] = *frame.member;
+            if (frame.count++ != 0)
+                sink.put(',');
+            sink.write("<br/>");
+            indent(sink, frame.layer);
+            sink.write(theme_->string_open());
+            write_string(sink, key);
+            sink.write("</span>: ");
+            ++frame.member;
+            to_html_value(value_node, frame.layer + 1, sink);
+        }
     }
 }
 
-std::string neroll::Stringifier::to_html() const {
-    std::string html = R"(
+void neroll::Stringifier::to_html(Sink &sink) {
+    sink.write(R"(
         <!DOCTYPE html>
         <html>
         <head>
@@ -662,15 +1296,32 @@ std::string neroll::Stringifier::to_html() const {
         </head>
         <body>
             <div class="code">
-    )";
+    )");
 
-    html.append(to_html_traverse(json_ast_, 1));
+    [[maybe_unused]] auto start = STATS_ENABLED ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+    to_html_traverse(json_ast_, 1, sink);
+    with_stats(stats_, [&](auto &stats) {
+        stats.render_time += std::chrono::steady_clock::now() - start;
+    });
 
-    html.append(R"(
+    sink.write(R"(
         </div>
     </body>
     </html>
     )");
+}
 
+auto neroll::Stringifier::stats() const -> Stats {
+    Stats stats;
+    with_stats(stats_, [&](const auto &own) {
+        stats = own;
+    });
+    return stats;
+}
+
+std::string neroll::Stringifier::to_html() {
+    std::string html;
+    StringSink sink(html);
+    to_html(sink);
     return html;
-}
\ No newline at end of file
+}
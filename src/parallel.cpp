@@ -0,0 +1,207 @@
+#include "njson.h"
+
+#include <cstring>      // memcpy
+#include <thread>       // thread
+#include <atomic>       // atomic
+#include <algorithm>    // min
+
+namespace {
+
+    // chunks per thread, more than one so that a slow chunk can be
+    // balanced by the others
+    constexpr std::size_t CHUNKS_PER_THREAD = 4;
+
+}
+
+neroll::ParallelParser::ParallelParser(ParseOptions options, unsigned threads)
+    : options_(options), threads_(threads) {
+    if (threads_ == 0)
+        threads_ = std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Cuts the contents of the root container at top-level commas into chunks
+// of roughly equal size. Returns false if the input should be left to the
+// serial parser.
+//
+// The input is cut into pieces of equal size, which the threads summarize
+// at once: their quote parity and what they do to the depth. Chaining the
+// summaries gives the state every piece starts in, and then each piece
+// looks for the first top-level comma from its start. Pieces without one
+// join the chunk before them. The piece where the depth drops to 0 holds
+// the end of the root.
+auto neroll::ParallelParser::split(std::string_view json, std::vector<Chunk> &chunks) const -> bool {
+    auto first = json.find_first_not_of(" \t\r\n");
+    if (first == std::string_view::npos || (json[first] != '[' && json[first] != '{'))
+        return false;
+    char close = json[first] == '[' ? ']' : '}';
+
+    auto pieces = std::size_t{threads_} * CHUNKS_PER_THREAD;
+    auto step = (json.size() - first - 1) / pieces + 1;
+    auto piece_begin = [&](std::size_t i) {
+        return std::min(first + 1 + i * step, json.size());
+    };
+    std::vector<RangeSummary> summaries(pieces);
+    run(pieces, [&](std::size_t i) {
+        summaries[i] = summarize_range(json, piece_begin(i), piece_begin(i + 1));
+    });
+
+    // the state at the start of every piece, up to the one that closes
+    // the root
+    struct State {
+        bool in_string;
+        std::size_t depth;
+    };
+    std::vector<State> states;
+    State state{false, 1};
+    bool closed = false;
+    for (auto &summary : summaries) {
+        states.push_back(state);
+        if (static_cast<std::int64_t>(state.depth) + summary.min_depth[state.in_string] <= 0) {
+            closed = true;
+            break;
+        }
+        state.depth += summary.depth[state.in_string];
+        state.in_string = state.in_string != summary.odd_quotes;
+    }
+    if (!closed)
+        return false;   // let the parser report it
+
+    auto last = states.size() - 1;
+    std::vector<std::size_t> commas(states.size(), std::string_view::npos);
+    std::size_t end = 0;
+    run(states.size(), [&](std::size_t i) {
+        auto begin = piece_begin(i);
+        auto &[in_string, depth] = states[i];
+        if (i > 0)
+            commas[i] = find_top_level(json, begin, piece_begin(i + 1), in_string, depth);
+        if (i == last)
+            end = find_close(json, begin, piece_begin(i + 1), in_string, depth);
+    });
+
+    std::size_t begin = first + 1;
+    for (auto comma : commas) {
+        if (comma == std::string_view::npos || json[comma] != ',')
+            continue;
+        chunks.push_back({begin, comma, 0, Document{json}});
+        begin = comma + 1;
+    }
+    if (end == std::string_view::npos)
+        return false;
+    chunks.push_back({begin, end, 0, Document{json}});
+    // the root is closed by the other bracket, let the parser report it
+    return json[end] == close && chunks.size() > 1;
+}
+
+void neroll::ParallelParser::parse_chunk(std::string_view json, AstType type, Chunk &chunk) const {
+    Lexer lexer{json.substr(0, chunk.end)};
+    lexer.seek(chunk.begin);
+    Parser parser(std::move(lexer), options_);
+    DocumentBuilder builder(chunk.document, options_.duplicate_keys);
+    if (type == AstType::ARRAY)
+        chunk.failed = !parser.try_parse_elements(builder);
+    else
+        chunk.failed = !parser.try_parse_members(builder);
+
+    // values on the top level of the tape, keys included
+    for (std::size_t i = 0; !chunk.failed && i < chunk.document.tape_size(); i = chunk.document.next_index(i))
+        chunk.count++;
+    if (type == AstType::OBJECT)
+        chunk.count /= 2;
+}
+
+// Copies the tape of a chunk to `out`. Container sizes are relative and
+// need no change, decoded strings move by `strings_offset`.
+void neroll::ParallelParser::copy_chunk(const Chunk &chunk, std::size_t strings_offset, std::uint64_t *out) {
+    const auto &document = chunk.document;
+    for (std::size_t i = 0; i < document.tape_size(); ) {
+        auto slot = document.slot_at(i);
+        switch (document.type_at(i)) {
+            case AstType::STRING:
+                if (!(slot & Document::SOURCE_STRING))
+                    slot += strings_offset;
+                [[fallthrough]];
+            case AstType::INT:
+            case AstType::FLOAT:
+            case AstType::ARRAY:
+            case AstType::OBJECT:
+                out[i] = slot;
+                out[i + 1] = document.slot_at(i + 1);
+                i += 2;
+                break;
+            case AstType::BOOLEAN:
+            case AstType::NIL:
+                out[i] = slot;
+                i += 1;
+                break;
+        }
+    }
+}
+
+// Calls `work` for every index below `count`, one index at a time. The
+// calling thread is one of the workers.
+void neroll::ParallelParser::run(std::size_t count, const std::function<void(std::size_t)> &work) const {
+    std::atomic<std::size_t> next{0};
+    auto worker = [&] {
+        for (auto i = next.fetch_add(1); i < count; i = next.fetch_add(1))
+            work(i);
+    };
+
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < std::min<std::size_t>(threads_, count); i++)
+        workers.emplace_back(worker);
+    worker();
+    for (auto &thread : workers)
+        thread.join();
+}
+
+auto neroll::ParallelParser::parse(std::string_view json) const -> Document {
+    auto serial = [&] {
+        return Parser(Lexer{json}, options_).parse();
+    };
+    if (threads_ < 2 || json.size() < MIN_PARALLEL_SIZE)
+        return serial();
+
+    std::vector<Chunk> chunks;
+    if (!split(json, chunks))
+        return serial();
+    auto type = json[chunks[0].begin - 1] == '[' ? AstType::ARRAY : AstType::OBJECT;
+    // duplicates may be in different chunks
+    if (type == AstType::OBJECT && options_.duplicate_keys != DuplicateKeys::KEEP_ALL)
+        return serial();
+
+    run(chunks.size(), [&](std::size_t i) {
+        parse_chunk(json, type, chunks[i]);
+    });
+
+    std::size_t tape_size = 2;
+    std::size_t strings_size = 0;
+    std::size_t count = 0;
+    bool key_indexes = false;
+    std::vector<std::size_t> tape_offsets;
+    std::vector<std::size_t> strings_offsets;
+    for (auto &chunk : chunks) {
+        if (chunk.failed)
+            return serial();
+        tape_offsets.push_back(tape_size);
+        strings_offsets.push_back(strings_size);
+        tape_size += chunk.document.tape_size();
+        strings_size += chunk.document.strings_.size();
+        count += chunk.count;
+        key_indexes = key_indexes || chunk.document.key_indexes_;
+    }
+
+    Document document(json);
+    document.tape_.resize(tape_size);
+    document.strings_.resize(strings_size);
+    document.tape_[0] = (static_cast<std::uint64_t>(type) << Document::TAG_SHIFT) | tape_size;
+    document.tape_[1] = count;
+    if (key_indexes || (type == AstType::OBJECT && count >= Document::HASH_INDEX_THRESHOLD))
+        document.enable_key_indexes();
+
+    run(chunks.size(), [&](std::size_t i) {
+        auto &strings = chunks[i].document.strings_;
+        copy_chunk(chunks[i], strings_offsets[i], document.tape_.data() + tape_offsets[i]);
+        std::memcpy(document.strings_.data() + strings_offsets[i], strings.data(), strings.size());
+    });
+    return document;
+}
@@ -0,0 +1,186 @@
+#include "njson.h"
+
+#include <stdexcept>    // runtime_error
+#include <format>       // format
+#include <charconv>     // from_chars
+
+namespace {
+
+    [[noreturn]] void throw_query_error(std::string_view path, std::string_view message) {
+        neroll::throw_exception(std::runtime_error(std::format("invalid query {}: {}", path, message)));
+    }
+
+    bool parse_index(std::string_view text, std::size_t &index) {
+        if (text.empty() || (text.size() > 1 && text[0] == '0'))
+            return false;
+        auto [end, errc] = std::from_chars(text.data(), text.data() + text.size(), index);
+        return errc == std::errc{} && end == text.data() + text.size();
+    }
+
+}
+
+neroll::Query::Query(std::string_view path) {
+    if (path.empty())
+        return;
+    if (path[0] == '/')
+        compile_pointer(path);
+    else if (path[0] == '$')
+        compile_json_path(path);
+    else
+        throw_query_error(path, "expect / or $ at the beginning");
+}
+
+void neroll::Query::compile_pointer(std::string_view path) {
+    std::size_t begin = 1;
+    while (true) {
+        auto end = std::min(path.find('/', begin), path.size());
+        auto text = path.substr(begin, end - begin);
+
+        Step step{Step::Kind::KEY, {}};
+        for (std::size_t i = 0; i < text.size(); i++) {
+            if (text[i] != '~') {
+                step.key += text[i];
+            } else if (i + 1 < text.size() && (text[i + 1] == '0' || text[i + 1] == '1')) {
+                step.key += text[i + 1] == '0' ? '~' : '/';
+                i++;
+            } else {
+                throw_query_error(path, "~ must be followed by 0 or 1");
+            }
+        }
+        if (text == "*")
+            step.kind = Step::Kind::ANY;
+        else if (parse_index(text, step.index))
+            step.kind = Step::Kind::KEY_OR_INDEX;
+        steps_.push_back(std::move(step));
+
+        if (end == path.size())
+            return;
+        begin = end + 1;
+    }
+}
+
+void neroll::Query::compile_json_path(std::string_view path) {
+    std::size_t i = 1;
+    while (i < path.size()) {
+        Step step{Step::Kind::KEY, {}};
+        if (path[i] == '.') {
+            auto end = std::min(path.find_first_of(".[", i + 1), path.size());
+            step.key = path.substr(i + 1, end - i - 1);
+            if (step.key.empty())
+                throw_query_error(path, "empty name after .");
+            if (step.key == "*")
+                step.kind = Step::Kind::ANY;
+            i = end;
+        } else if (path[i] == '[') {
+            auto close = path.find(']', i);
+            if (i + 1 < path.size() && (path[i + 1] == '\'' || path[i + 1] == '\"')) {
+                // quoted name, a backslash escapes the next character
+                char quote = path[i + 1];
+                for (i += 2; i < path.size() && path[i] != quote; i++) {
+                    if (path[i] == '\\' && i + 1 < path.size())
+                        i++;
+                    step.key += path[i];
+                }
+                if (i + 1 >= path.size() || path[i + 1] != ']')
+                    throw_query_error(path, "unterminated name in []");
+                i += 2;
+            } else if (close == std::string_view::npos) {
+                throw_query_error(path, "missing ]");
+            } else {
+                auto text = path.substr(i + 1, close - i - 1);
+                if (text == "*")
+                    step.kind = Step::Kind::ANY;
+                else if (parse_index(text, step.index))
+                    step.kind = Step::Kind::INDEX;
+                else
+                    throw_query_error(path, "expect an index, * or a quoted name in []");
+                i = close + 1;
+            }
+        } else {
+            throw_query_error(path, "expect . or [");
+        }
+        steps_.push_back(std::move(step));
+    }
+}
+
+auto neroll::Query::select(std::string_view json) const -> std::vector<Document> {
+    std::vector<Document> matches;
+    std::string scratch;
+    Lexer lexer{json};
+    auto token = lexer.next_token();
+    lexer.expect_value(token);
+    select(lexer, token, 0, scratch, matches);
+    return matches;
+}
+
+// Matches the value that starts with `first` against the steps from
+// `depth` on and moves the lexer past it. Only a "*" step looks at more
+// than the first matching member, like ObjectNode::at.
+void neroll::Query::select(Lexer &lexer, const Token &first, std::size_t depth,
+        std::string &scratch, std::vector<Document> &matches) const {
+    if (depth == steps_.size()) {
+        Lexer value{lexer.source()};
+        value.seek(first.offset);
+        matches.push_back(Parser(std::move(value)).parse());
+        lexer.skip_value(first);
+        return;
+    }
+
+    const Step &step = steps_[depth];
+    if (first.type == TokenType::LBRACE && step.kind != Step::Kind::INDEX) {
+        auto token = lexer.next_token();
+        if (token.type == TokenType::RBRACE)
+            return;
+        while (true) {
+            if (token.type != TokenType::STRING)
+                lexer.throw_error(token.offset, "object key should be a string");
+            bool match = step.kind == Step::Kind::ANY || string_value(token, scratch) == step.key;
+            token = lexer.next_token();
+            if (token.type != TokenType::COLON)
+                lexer.throw_error(token.offset, "expect colon after key");
+
+            token = lexer.next_token();
+            lexer.expect_value(token);
+            if (!match) {
+                lexer.skip_value(token);
+            } else {
+                select(lexer, token, depth + 1, scratch, matches);
+                if (step.kind != Step::Kind::ANY)
+                    return lexer.skip_container();
+            }
+
+            token = lexer.next_token();
+            if (token.type == TokenType::COMMA)
+                token = lexer.next_token();
+            else if (token.type == TokenType::RBRACE)
+                return;
+            else
+                lexer.throw_error(token.offset, "missing comma or right brace when parsing object");
+        }
+    } else if (first.type == TokenType::LBRACKET && step.kind != Step::Kind::KEY) {
+        auto token = lexer.next_token();
+        if (token.type == TokenType::RBRACKET)
+            return;
+        for (std::size_t i = 0; ; i++) {
+            lexer.expect_value(token);
+            if (step.kind == Step::Kind::ANY) {
+                select(lexer, token, depth + 1, scratch, matches);
+            } else if (i == step.index) {
+                select(lexer, token, depth + 1, scratch, matches);
+                return lexer.skip_container();
+            } else {
+                lexer.skip_value(token);
+            }
+
+            token = lexer.next_token();
+            if (token.type == TokenType::COMMA)
+                token = lexer.next_token();
+            else if (token.type == TokenType::RBRACKET)
+                return;
+            else
+                lexer.throw_error(token.offset, "missing comma or right bracket when parsing array");
+        }
+    } else {
+        lexer.skip_value(first);
+    }
+}
@@ -0,0 +1,52 @@
+#include "njson.h"
+
+#include <stdexcept>    // runtime_error
+#include <format>       // format
+#include <ostream>      // ostream
+#include <cstring>      // memcpy, strerror
+#include <cerrno>       // errno, EINTR
+
+#ifdef _WIN32
+#include <io.h>         // _write
+#else
+#include <unistd.h>     // write
+#endif
+
+void neroll::BufferedSink::write(std::string_view text) {
+    if (text.size() > BUFFER_SIZE - size_) {
+        flush();
+        // too large to be worth buffering
+        if (text.size() >= BUFFER_SIZE)
+            return drain(text);
+    }
+    std::memcpy(buffer_.get() + size_, text.data(), text.size());
+    size_ += text.size();
+}
+
+void neroll::BufferedSink::flush() {
+    if (size_ == 0)
+        return;
+    auto size = size_;
+    size_ = 0;
+    drain({buffer_.get(), size});
+}
+
+void neroll::StreamSink::drain(std::string_view text) {
+    os_.write(text.data(), static_cast<std::streamsize>(text.size()));
+}
+
+void neroll::FileSink::drain(std::string_view text) {
+    while (!text.empty()) {
+#ifdef _WIN32
+        auto written = ::_write(fd_, text.data(), static_cast<unsigned>(text.size()));
+#else
+        auto written = ::write(fd_, text.data(), text.size());
+#endif
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            throw_exception(std::runtime_error(std::format("can not write to file: {}", std::strerror(errno))));
+        }
+        text.remove_prefix(static_cast<std::size_t>(written));
+    }
+}
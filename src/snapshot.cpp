@@ -0,0 +1,288 @@
+#include "njson.h"
+
+#include <stdexcept>    // runtime_error
+#include <format>       // format
+#include <fstream>      // ofstream
+#include <filesystem>   // file_size, last_write_time, rename
+#include <cstring>      // memcmp, memcpy
+#include <algorithm>    // min
+#include <random>       // random_device
+#include <chrono>       // steady_clock
+
+namespace {
+
+    constexpr char SNAPSHOT_MAGIC[8] = {'N', 'J', 'S', 'O', 'N', 'T', 'A', 'P'};
+
+    // the first bytes of a snapshot, followed by the tape and then the
+    // strings; its size keeps the tape 8-byte aligned
+    struct SnapshotHeader {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t reserved;         // 0
+        std::uint64_t tape_size;        // slots
+        std::uint64_t strings_size;     // bytes
+        std::uint64_t source_size;
+        std::int64_t source_time;       // last write time of the source
+        std::uint64_t checksum;         // of the tape and the strings
+    };
+
+    static_assert(sizeof(SnapshotHeader) % sizeof(std::uint64_t) == 0);
+
+    // FNV-1a over 64-bit words, the strings are padded with zeros
+    std::uint64_t checksum(const std::uint64_t *tape, std::size_t tape_size, std::string_view strings) {
+        std::uint64_t hash = 0xcbf29ce484222325;
+        auto mix = [&](std::uint64_t word) {
+            hash = (hash ^ word) * 0x100000001b3;
+        };
+        for (std::size_t i = 0; i < tape_size; i++)
+            mix(tape[i]);
+        for (std::size_t i = 0; i < strings.size(); i += sizeof(std::uint64_t)) {
+            std::uint64_t word = 0;
+            std::memcpy(&word, strings.data() + i, std::min(sizeof(word), strings.size() - i));
+            mix(word);
+        }
+        return hash;
+    }
+
+    // size and last write time of the source, as recorded in the header;
+    // false if the source can not be read
+    bool source_info(const std::string &source_path, std::uint64_t &size, std::int64_t &time) {
+        std::error_code error;
+        size = std::filesystem::file_size(source_path, error);
+        if (error)
+            return false;
+        time = std::filesystem::last_write_time(source_path, error).time_since_epoch().count();
+        return !error;
+    }
+
+    // A name next to `path` for a writer of its own. 64 random bits keep
+    // processes and threads that write the same snapshot apart.
+    std::string temporary_path(const std::string &path) {
+        std::random_device device;
+        auto suffix = (static_cast<std::uint64_t>(device()) << 32) ^ device()
+            ^ static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+        return std::format("{}.{:016x}.tmp", path, suffix);
+    }
+
+    // the header of the snapshot at `path` if it has one of this version
+    bool read_header(const std::string &path, SnapshotHeader &header) {
+        std::ifstream fin(path, std::ios::binary);
+        return fin.read(reinterpret_cast<char *>(&header), sizeof(header))
+            && std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0
+            && header.version == neroll::SNAPSHOT_VERSION;
+    }
+
+    // Whether `tape` holds exactly one value whose containers and strings
+    // stay within the tape and the strings, with the element counts the
+    // containers claim. Saved strings never point into a source.
+    bool valid_tape(const std::uint64_t *tape, std::size_t tape_size, std::uint64_t strings_size) {
+        using neroll::AstType;
+        using neroll::Document;
+        struct Open {
+            std::size_t end;
+            std::uint64_t count;    // elements, or members of an object
+            std::uint64_t seen;     // values, keys included
+            bool object;
+        };
+        std::vector<Open> open;
+
+        if (tape_size == 0)
+            return false;
+        std::size_t i = 0;
+        do {
+            if (!open.empty()) {
+                auto &parent = open.back();
+                if (parent.object && parent.seen % 2 == 0
+                        && static_cast<AstType>(tape[i] >> Document::TAG_SHIFT) != AstType::STRING)
+                    return false;
+                parent.seen++;
+            }
+            auto limit = open.empty() ? tape_size : open.back().end;
+            auto payload = tape[i] & Document::PAYLOAD_MASK;
+            switch (static_cast<AstType>(tape[i] >> Document::TAG_SHIFT)) {
+                case AstType::STRING:
+                    if (payload & Document::SOURCE_STRING || limit - i < 2
+                            || payload > strings_size || tape[i + 1] > strings_size - payload)
+                        return false;
+                    i += 2;
+                    break;
+                case AstType::INT:
+                case AstType::FLOAT:
+                    if (limit - i < 2)
+                        return false;
+                    i += 2;
+                    break;
+                case AstType::BOOLEAN:
+                    if (payload > 1)
+                        return false;
+                    i += 1;
+                    break;
+                case AstType::NIL:
+                    i += 1;
+                    break;
+                case AstType::ARRAY:
+                case AstType::OBJECT:
+                    if (payload < 2 || payload > limit - i)
+                        return false;
+                    open.push_back({i + payload, tape[i + 1], 0,
+                        static_cast<AstType>(tape[i] >> Document::TAG_SHIFT) == AstType::OBJECT});
+                    i += 2;
+                    break;
+                default:
+                    return false;
+            }
+
+            // close the containers that end here
+            while (!open.empty() && i == open.back().end) {
+                auto &container = open.back();
+                if (container.seen != (container.object ? container.count * 2 : container.count))
+                    return false;
+                open.pop_back();
+            }
+        } while (!open.empty());
+        return i == tape_size;
+    }
+
+    // What is wrong with the snapshot `data`, empty if nothing is. Without
+    // `verify` only the header is read, which is all a load needs to map
+    // the document safely from a snapshot that this library wrote.
+    std::string check_snapshot(std::string_view data, bool verify) {
+        SnapshotHeader header;
+        if (data.size() < sizeof(header))
+            return "is too short";
+        std::memcpy(&header, data.data(), sizeof(header));
+        if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0)
+            return "has no snapshot header";
+        if (header.version != neroll::SNAPSHOT_VERSION)
+            return std::format("has version {}, expect {}", header.version, neroll::SNAPSHOT_VERSION);
+        auto tape_bytes = header.tape_size * sizeof(std::uint64_t);
+        if (data.size() - sizeof(header) != tape_bytes + header.strings_size || header.tape_size == 0)
+            return "is truncated";
+
+        // mappings are page aligned and the header keeps the tape aligned
+        if (reinterpret_cast<std::uintptr_t>(data.data()) % alignof(std::uint64_t) != 0)
+            return "is not aligned in memory";
+        if (!verify)
+            return {};
+
+        auto tape = reinterpret_cast<const std::uint64_t *>(data.data() + sizeof(header));
+        if (checksum(tape, header.tape_size, data.substr(sizeof(header) + tape_bytes)) != header.checksum)
+            return "is corrupt";
+        // the checksum only catches accidents, the nodes read the tape
+        // without bounds checks
+        if (!valid_tape(tape, header.tape_size, header.strings_size))
+            return "is malformed";
+        return {};
+    }
+
+    // the document in a snapshot that passed check_snapshot()
+    auto view_snapshot(std::shared_ptr<const neroll::MappedFile> file) -> neroll::Document {
+        auto data = file->data();
+        SnapshotHeader header;
+        std::memcpy(&header, data.data(), sizeof(header));
+        auto tape = reinterpret_cast<const std::uint64_t *>(data.data() + sizeof(header));
+        auto strings = data.substr(sizeof(header) + header.tape_size * sizeof(std::uint64_t));
+        return neroll::Document::view({tape, header.tape_size}, strings, std::move(file));
+    }
+
+}
+
+void neroll::save_snapshot(const Document &document, const std::string &path, const std::string &source_path) {
+    if (!try_save_snapshot(document, path, source_path))
+        throw_exception(std::runtime_error(std::format("can not write snapshot {}", path)));
+}
+
+bool neroll::try_save_snapshot(const Document &document, const std::string &path, const std::string &source_path) {
+    // strings that point into the source text move to the string area
+    std::vector<std::uint64_t> tape(document.tape(), document.tape() + document.tape_size());
+    std::string strings(document.strings());
+    for (std::size_t i = 0; i < tape.size(); ) {
+        switch (document.type_at(i)) {
+            case AstType::STRING:
+                if (document.payload_at(i) & Document::SOURCE_STRING) {
+                    tape[i] = (static_cast<std::uint64_t>(AstType::STRING) << Document::TAG_SHIFT) | strings.size();
+                    strings.append(document.string_at(i));
+                }
+                [[fallthrough]];
+            case AstType::INT:
+            case AstType::FLOAT:
+            case AstType::ARRAY:
+            case AstType::OBJECT:
+                i += 2;
+                break;
+            case AstType::BOOLEAN:
+            case AstType::NIL:
+                i += 1;
+                break;
+        }
+    }
+
+    SnapshotHeader header{};
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.tape_size = tape.size();
+    header.strings_size = strings.size();
+    if (!source_info(source_path, header.source_size, header.source_time))
+        return false;
+    header.checksum = checksum(tape.data(), tape.size(), strings);
+
+    // written next to the target under a name of its own and renamed, so
+    // that a reader never sees half a snapshot and writers do not write
+    // into each other's files
+    auto temporary = temporary_path(path);
+    bool written;
+    {
+        std::ofstream fout(temporary, std::ios::binary | std::ios::trunc);
+        fout.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        fout.write(reinterpret_cast<const char *>(tape.data()), tape.size() * sizeof(std::uint64_t));
+        fout.write(strings.data(), strings.size());
+        written = static_cast<bool>(fout.flush());
+    }
+    std::error_code error;
+    if (written)
+        std::filesystem::rename(temporary, path, error);
+    if (!written || error) {
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+    return true;
+}
+
+auto neroll::load_snapshot(const std::string &path) -> Document {
+    auto file = std::make_shared<const MappedFile>(path, false);
+    if (auto problem = check_snapshot(file->data(), false); !problem.empty())
+        throw_exception(std::runtime_error(std::format("snapshot {} {}", path, problem)));
+    return view_snapshot(std::move(file));
+}
+
+bool neroll::verify_snapshot(const std::string &path) {
+    std::error_code error;
+    if (!std::filesystem::is_regular_file(path, error))
+        return false;
+    MappedFile file(path);
+    return check_snapshot(file.data(), true).empty();
+}
+
+bool neroll::snapshot_is_current(const std::string &path, const std::string &source_path) {
+    SnapshotHeader header;
+    std::uint64_t size;
+    std::int64_t time;
+    if (!read_header(path, header) || !source_info(source_path, size, time))
+        return false;
+    return header.source_size == size && header.source_time == time;
+}
+
+auto neroll::load_cached(const std::string &source_path, const std::string &snapshot_path,
+        ParseOptions options) -> Document {
+    if (snapshot_is_current(snapshot_path, source_path)) {
+        // rebuilt below if it is cut short
+        auto file = std::make_shared<const MappedFile>(snapshot_path, false);
+        if (check_snapshot(file->data(), false).empty())
+            return view_snapshot(std::move(file));
+    }
+    auto document = parse_file(source_path, options);
+    // a cache that can not be written, like a read-only or full directory,
+    // only costs the next load a parse
+    try_save_snapshot(document, snapshot_path, source_path);
+    return document;
+}
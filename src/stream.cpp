@@ -0,0 +1,289 @@
+#include "njson.h"
+
+#include <stdexcept>    // runtime_error
+#include <format>       // format
+
+namespace {
+
+    bool is_white(char ch) {
+        return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+    }
+
+    // bytes that end a number or a literal
+    bool is_delimiter(char ch) {
+        switch (ch) {
+            case '{':
+            case '}':
+            case '[':
+            case ']':
+            case ':':
+            case ',':
+            case '\"':
+                return true;
+            default:
+                return is_white(ch);
+        }
+    }
+
+    // index of the closing quote of a string whose body starts at `begin`,
+    // or npos; `escape` carries an unfinished escape between calls
+    std::size_t find_string_end(std::string_view text, std::size_t begin, bool &escape) {
+        for (auto i = begin; i < text.size(); i++) {
+            if (escape)
+                escape = false;
+            else if (text[i] == '\\')
+                escape = true;
+            else if (text[i] == '\"')
+                return i;
+        }
+        return std::string_view::npos;
+    }
+
+}
+
+void neroll::StreamParser::feed(std::string_view chunk) {
+    std::size_t i = 0;
+    if (pending_kind_ == Pending::STRING)
+        i = continue_string(chunk);
+    else if (pending_kind_ == Pending::BARE)
+        i = continue_bare(chunk);
+
+    while (i < chunk.size()) {
+        switch (chunk[i]) {
+            case '\n':
+                line_++;
+                line_start_ = offset_ + i + 1;
+                i++;
+                break;
+            case ' ':
+            case '\t':
+            case '\r':
+                i++;
+                break;
+            case '{':
+                handle({chunk.substr(i, 1), TokenType::LBRACE, offset_ + i});
+                i++;
+                break;
+            case '}':
+                handle({chunk.substr(i, 1), TokenType::RBRACE, offset_ + i});
+                i++;
+                break;
+            case '[':
+                handle({chunk.substr(i, 1), TokenType::LBRACKET, offset_ + i});
+                i++;
+                break;
+            case ']':
+                handle({chunk.substr(i, 1), TokenType::RBRACKET, offset_ + i});
+                i++;
+                break;
+            case ':':
+                handle({chunk.substr(i, 1), TokenType::COLON, offset_ + i});
+                i++;
+                break;
+            case ',':
+                handle({chunk.substr(i, 1), TokenType::COMMA, offset_ + i});
+                i++;
+                break;
+            case '\"': {
+                bool escape = false;
+                auto end = find_string_end(chunk, i + 1, escape);
+                if (end == std::string_view::npos) {
+                    pending_kind_ = Pending::STRING;
+                    pending_.assign(chunk.substr(i));
+                    pending_offset_ = offset_ + i;
+                    pending_escape_ = escape;
+                    i = chunk.size();
+                    break;
+                }
+                lex(chunk.substr(i, end + 1 - i), offset_ + i);
+                i = end + 1;
+                break;
+            }
+            default: {
+                auto end = i + 1;
+                while (end < chunk.size() && !is_delimiter(chunk[end]))
+                    end++;
+                if (end == chunk.size()) {
+                    // the next chunk may continue this number or literal
+                    pending_kind_ = Pending::BARE;
+                    pending_.assign(chunk.substr(i));
+                    pending_offset_ = offset_ + i;
+                    i = chunk.size();
+                    break;
+                }
+                lex(chunk.substr(i, end - i), offset_ + i);
+                i = end;
+                break;
+            }
+        }
+    }
+    offset_ += chunk.size();
+}
+
+void neroll::StreamParser::finish() {
+    if (pending_kind_ != Pending::NONE) {
+        lex(pending_, pending_offset_);
+        pending_.clear();
+        pending_kind_ = Pending::NONE;
+    }
+    if (state_ != State::VALUE || !open_.empty())
+        throw_error("unexpected end of input", offset_);
+}
+
+auto neroll::StreamParser::take_document() -> Document {
+    if (ready_.empty())
+        throw_exception(std::runtime_error("no complete document"));
+    auto document = std::move(ready_.front());
+    ready_.pop_front();
+    return document;
+}
+
+auto neroll::StreamParser::continue_string(std::string_view chunk) -> std::size_t {
+    auto end = find_string_end(chunk, 0, pending_escape_);
+    if (end == std::string_view::npos) {
+        pending_.append(chunk);
+        return chunk.size();
+    }
+    pending_.append(chunk.substr(0, end + 1));
+    lex(pending_, pending_offset_);
+    pending_.clear();
+    pending_kind_ = Pending::NONE;
+    return end + 1;
+}
+
+auto neroll::StreamParser::continue_bare(std::string_view chunk) -> std::size_t {
+    std::size_t end = 0;
+    while (end < chunk.size() && !is_delimiter(chunk[end]))
+        end++;
+    pending_.append(chunk.substr(0, end));
+    if (end == chunk.size())
+        return end;
+    lex(pending_, pending_offset_);
+    pending_.clear();
+    pending_kind_ = Pending::NONE;
+    return end;
+}
+
+// `text` holds complete tokens only, usually exactly one
+void neroll::StreamParser::lex(std::string_view text, std::size_t offset) {
+    Lexer lexer{text};
+    lexer.set_origin({line_, offset - line_start_ + 1});
+    for (auto token = lexer.next_token(); token.type != TokenType::END; token = lexer.next_token()) {
+        token.offset += offset;
+        handle(token);
+    }
+}
+
+void neroll::StreamParser::handle(const Token &token) {
+    switch (state_) {
+        case State::VALUE:
+            return value(token);
+        case State::ARRAY_FIRST:
+            if (token.type == TokenType::RBRACKET) {
+                open_.pop_back();
+                builder_.on_end_array();
+                return after_value();
+            }
+            return value(token);
+        case State::OBJECT_FIRST:
+            if (token.type == TokenType::RBRACE) {
+                open_.pop_back();
+                builder_.on_end_object();
+                return after_value();
+            }
+            [[fallthrough]];
+        case State::OBJECT_KEY:
+            if (token.type != TokenType::STRING)
+                throw_error("object key should be a string", token.offset);
+            if (!builder_.on_key(string_value(token, unescaped_)))
+                throw_error(std::format("duplicate key {}", token.content), token.offset);
+            state_ = State::COLON;
+            return;
+        case State::COLON:
+            if (token.type != TokenType::COLON)
+                throw_error("expect colon after key", token.offset);
+            state_ = State::VALUE;
+            return;
+        case State::AFTER_VALUE:
+            if (open_.back() == TokenType::LBRACKET) {
+                if (token.type == TokenType::COMMA) {
+                    state_ = State::VALUE;
+                } else if (token.type == TokenType::RBRACKET) {
+                    open_.pop_back();
+                    builder_.on_end_array();
+                    after_value();
+                } else {
+                    throw_error("missing comma or right bracket when parsing array", token.offset);
+                }
+            } else {
+                if (token.type == TokenType::COMMA) {
+                    state_ = State::OBJECT_KEY;
+                } else if (token.type == TokenType::RBRACE) {
+                    open_.pop_back();
+                    builder_.on_end_object();
+                    after_value();
+                } else {
+                    throw_error("missing comma or right brace when parsing object", token.offset);
+                }
+            }
+            return;
+    }
+}
+
+void neroll::StreamParser::push_container(const Token &token) {
+    if (open_.size() >= options_.max_depth)
+        throw_error(std::format("nesting is deeper than the maximum depth {}", options_.max_depth), token.offset);
+    open_.push_back(token.type);
+}
+
+void neroll::StreamParser::value(const Token &token) {
+    switch (token.type) {
+        case TokenType::LBRACE:
+            push_container(token);
+            builder_.on_start_object();
+            state_ = State::OBJECT_FIRST;
+            return;
+        case TokenType::LBRACKET:
+            push_container(token);
+            builder_.on_start_array();
+            state_ = State::ARRAY_FIRST;
+            return;
+        case TokenType::STRING:
+            builder_.on_string(string_value(token, unescaped_));
+            break;
+        case TokenType::NUMBER:
+            if (token.is_float)
+                builder_.on_double(token.floating);
+            else
+                builder_.on_int(token.integer);
+            break;
+        case TokenType::TRUE:
+            builder_.on_bool(true);
+            break;
+        case TokenType::FALSE:
+            builder_.on_bool(false);
+            break;
+        case TokenType::NIL:
+            builder_.on_null();
+            break;
+        default:
+            throw_error(std::format("invalid token type: {}", token.name()), token.offset);
+    }
+    after_value();
+}
+
+void neroll::StreamParser::after_value() {
+    if (!open_.empty()) {
+        state_ = State::AFTER_VALUE;
+        return;
+    }
+    ready_.push_back(std::move(current_));
+    current_ = Document{};
+    state_ = State::VALUE;
+}
+
+// tokens never span lines, so the current line is the token's line
+void neroll::StreamParser::throw_error(std::string_view message, std::size_t offset) const {
+    throw_exception(std::runtime_error(std::format("error: line {}, column {}: {}",
+        line_, offset - line_start_ + 1, message)));
+}
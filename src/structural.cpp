@@ -0,0 +1,421 @@
+#include "njson.h"
+
+#include <cstring>      // memcpy, memset
+#include <algorithm>    // max
+
+// define NJSON_NO_SIMD to always use the portable classifier
+#if !defined(NJSON_NO_SIMD) && defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define NJSON_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+    // one bit per byte of a 64-byte block
+    struct BlockMasks {
+        std::uint64_t quote;
+        std::uint64_t backslash;
+        std::uint64_t white;
+        std::uint64_t op;       // { } [ ] : ,
+        std::uint64_t control;  // below 0x20, whitespace included
+    };
+
+    using Classifier = BlockMasks (*)(const char *block);
+
+    [[maybe_unused]] BlockMasks classify_scalar(const char *block) {
+        BlockMasks masks{};
+        for (int i = 0; i < 64; i++) {
+            std::uint64_t bit = std::uint64_t{1} << i;
+            if (static_cast<unsigned char>(block[i]) < 0x20)
+                masks.control |= bit;
+            switch (block[i]) {
+                case '\"':
+                    masks.quote |= bit;
+                    break;
+                case '\\':
+                    masks.backslash |= bit;
+                    break;
+                case ' ':
+                case '\t':
+                case '\r':
+                case '\n':
+                    masks.white |= bit;
+                    break;
+                case '{':
+                case '}':
+                case '[':
+                case ']':
+                case ':':
+                case ',':
+                    masks.op |= bit;
+                    break;
+                default:
+                    break;
+            }
+        }
+        return masks;
+    }
+
+#ifdef NJSON_X86_SIMD
+    // SSE2 is part of x86-64, so this path needs no runtime check
+    std::uint64_t any_of_sse2(const char *block, std::string_view chars) {
+        std::uint64_t mask = 0;
+        for (int i = 0; i < 4; i++) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + i * 16));
+            __m128i result = _mm_setzero_si128();
+            for (char ch : chars)
+                result = _mm_or_si128(result, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(ch)));
+            auto bits = static_cast<std::uint32_t>(_mm_movemask_epi8(result));
+            mask |= static_cast<std::uint64_t>(bits) << (i * 16);
+        }
+        return mask;
+    }
+
+    std::uint64_t control_sse2(const char *block) {
+        std::uint64_t mask = 0;
+        for (int i = 0; i < 4; i++) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + i * 16));
+            // unsigned bytes <= 0x1f are left unchanged by the minimum
+            __m128i result = _mm_cmpeq_epi8(_mm_min_epu8(bytes, _mm_set1_epi8(0x1f)), bytes);
+            auto bits = static_cast<std::uint32_t>(_mm_movemask_epi8(result));
+            mask |= static_cast<std::uint64_t>(bits) << (i * 16);
+        }
+        return mask;
+    }
+
+    BlockMasks classify_sse2(const char *block) {
+        BlockMasks masks;
+        masks.quote = any_of_sse2(block, "\"");
+        masks.backslash = any_of_sse2(block, "\\");
+        masks.white = any_of_sse2(block, " \t\r\n");
+        masks.op = any_of_sse2(block, "{}[]:,");
+        masks.control = control_sse2(block);
+        return masks;
+    }
+
+    __attribute__((target("avx2")))
+    std::uint64_t movemask_avx2(__m256i low, __m256i high) {
+        auto low_bits = static_cast<std::uint32_t>(_mm256_movemask_epi8(low));
+        auto high_bits = static_cast<std::uint32_t>(_mm256_movemask_epi8(high));
+        return low_bits | (static_cast<std::uint64_t>(high_bits) << 32);
+    }
+
+    __attribute__((target("avx2")))
+    __m256i any_of_avx2(__m256i bytes, std::string_view chars) {
+        __m256i result = _mm256_setzero_si256();
+        for (char ch : chars)
+            result = _mm256_or_si256(result, _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(ch)));
+        return result;
+    }
+
+    // Each character at the index of its low nibble, twice for the two
+    // lanes, and a byte of another low nibble everywhere else.
+    struct NibbleTable {
+        alignas(32) char bytes[32];
+    };
+
+    constexpr NibbleTable nibble_table(std::string_view chars) {
+        NibbleTable table{};
+        for (int i = 0; i < 32; i++)
+            table.bytes[i] = static_cast<char>((i % 16) ^ 1);
+        for (char ch : chars)
+            table.bytes[ch & 0xf] = table.bytes[16 + (ch & 0xf)] = ch;
+        return table;
+    }
+
+    // the characters of each table have different low nibbles
+    constexpr NibbleTable WHITE_TABLE = nibble_table(" \t\r\n");
+    constexpr NibbleTable BRACE_TABLE = nibble_table("{}:,");
+    constexpr NibbleTable BRACKET_TABLE = nibble_table("[]");
+
+    // One shuffle finds the bytes of a table: a byte matches if it equals
+    // the entry at its low nibble. The shuffle gives 0 for bytes with the
+    // high bit set, which never match either.
+    __attribute__((target("avx2")))
+    __m256i lookup_avx2(__m256i bytes, const NibbleTable &table) {
+        __m256i entries = _mm256_load_si256(reinterpret_cast<const __m256i *>(table.bytes));
+        return _mm256_cmpeq_epi8(_mm256_shuffle_epi8(entries, bytes), bytes);
+    }
+
+    __attribute__((target("avx2")))
+    __m256i op_avx2(__m256i bytes) {
+        return _mm256_or_si256(lookup_avx2(bytes, BRACE_TABLE), lookup_avx2(bytes, BRACKET_TABLE));
+    }
+
+    __attribute__((target("avx2")))
+    __m256i control_avx2(__m256i bytes) {
+        return _mm256_cmpeq_epi8(_mm256_min_epu8(bytes, _mm256_set1_epi8(0x1f)), bytes);
+    }
+
+    __attribute__((target("avx2")))
+    BlockMasks classify_avx2(const char *block) {
+        __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block));
+        __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + 32));
+        BlockMasks masks;
+        masks.quote = movemask_avx2(any_of_avx2(low, "\""), any_of_avx2(high, "\""));
+        masks.backslash = movemask_avx2(any_of_avx2(low, "\\"), any_of_avx2(high, "\\"));
+        masks.white = movemask_avx2(lookup_avx2(low, WHITE_TABLE), lookup_avx2(high, WHITE_TABLE));
+        masks.op = movemask_avx2(op_avx2(low), op_avx2(high));
+        masks.control = movemask_avx2(control_avx2(low), control_avx2(high));
+        return masks;
+    }
+#endif
+
+    Classifier pick_classifier() {
+#ifdef NJSON_X86_SIMD
+        if (__builtin_cpu_supports("avx2"))
+            return classify_avx2;
+        return classify_sse2;
+#else
+        return classify_scalar;
+#endif
+    }
+
+    // bit i of the result is the xor of bits 0..i
+    std::uint64_t prefix_xor(std::uint64_t bits) {
+        bits ^= bits << 1;
+        bits ^= bits << 2;
+        bits ^= bits << 4;
+        bits ^= bits << 8;
+        bits ^= bits << 16;
+        bits ^= bits << 32;
+        return bits;
+    }
+
+    // Carries the in-string and escape state from one block to the next.
+    class StructuralScanner {
+     public:
+        StructuralScanner() = default;
+
+        // for a scan that starts in the middle of the input
+        StructuralScanner(bool in_string, bool escaped)
+            : prev_in_string_(in_string ? ~std::uint64_t{0} : 0), prev_escaped_(escaped) {}
+
+        // the bytes from an opening quote up to, but not including, its
+        // closing quote
+        std::uint64_t strings(const BlockMasks &masks) {
+            std::uint64_t quote = masks.quote & ~find_escaped(masks.backslash);
+            std::uint64_t in_string = prefix_xor(quote) ^ prev_in_string_;
+            prev_in_string_ = static_cast<std::uint64_t>(static_cast<std::int64_t>(in_string) >> 63);
+            return in_string;
+        }
+
+        // whether a string is open after the last block
+        bool in_string() const {
+            return prev_in_string_ != 0;
+        }
+
+        std::uint64_t scan(const BlockMasks &masks) {
+            std::uint64_t in_string = strings(masks);
+
+            std::uint64_t op = masks.op & ~in_string;
+            std::uint64_t white = masks.white & ~in_string;
+
+            // the first byte of every run of strings, numbers and literals
+            std::uint64_t other = ~(op | white);
+            std::uint64_t starts = other & ~((other << 1) | prev_other_);
+            prev_other_ = other >> 63;
+
+            return op | starts;
+        }
+
+     private:
+        std::uint64_t prev_in_string_{0};   // all ones when a string is open
+        std::uint64_t prev_escaped_{0};     // first byte is escaped
+        std::uint64_t prev_other_{0};       // last byte belongs to a token
+
+        // Bytes preceded by an odd run of backslashes: a run that starts on
+        // an even bit and ends on an odd one (or the other way round) escapes
+        // the byte after it.
+        std::uint64_t find_escaped(std::uint64_t backslash) {
+            if (backslash == 0 && prev_escaped_ == 0)
+                return 0;
+            constexpr std::uint64_t even_bits = 0x5555'5555'5555'5555;
+            backslash &= ~prev_escaped_;
+            std::uint64_t follows_escape = (backslash << 1) | prev_escaped_;
+            std::uint64_t odd_starts = backslash & ~even_bits & ~follows_escape;
+            std::uint64_t even_carries = odd_starts + backslash;
+            prev_escaped_ = even_carries < backslash ? 1 : 0;
+            std::uint64_t invert_mask = even_carries << 1;
+            return (even_bits ^ invert_mask) & follows_escape;
+        }
+    };
+
+    // whether the byte at `offset` follows an odd run of backslashes
+    bool is_escaped(std::string_view json, std::size_t offset) {
+        std::size_t run = 0;
+        while (run < offset && json[offset - 1 - run] == '\\')
+            run++;
+        return run % 2 == 1;
+    }
+
+    // Calls `visit(masks, block, offset)` for the 64-byte blocks of
+    // json[begin, end), the last one padded with whitespace, until it
+    // returns false.
+    template <typename Visit>
+    void for_each_block(std::string_view json, std::size_t begin, std::size_t end, Visit visit) {
+        static const Classifier classify = pick_classifier();
+
+        end = std::min(end, json.size());
+        std::size_t offset = begin;
+        for (; offset + 64 <= end; offset += 64) {
+            if (!visit(classify(json.data() + offset), json.data() + offset, offset))
+                return;
+        }
+        if (offset < end) {
+            char block[64];
+            std::memset(block, ' ', sizeof(block));
+            std::memcpy(block, json.data() + offset, end - offset);
+            visit(classify(block), static_cast<const char *>(block), offset);
+        }
+    }
+
+
+    // the bracket that brings `depth` to 0, or with `commas` a comma at
+    // depth 1 if one comes first
+    std::size_t find_depth(std::string_view json, std::size_t begin, std::size_t end,
+            bool in_string, std::size_t depth, bool commas) {
+        std::size_t found = std::string_view::npos;
+        StructuralScanner scanner(in_string, is_escaped(json, begin));
+        for_each_block(json, begin, end, [&](const BlockMasks &masks, const char *block, std::size_t offset) {
+            for (auto bits = masks.op & ~scanner.strings(masks); bits != 0; bits &= bits - 1) {
+                int i = std::countr_zero(bits);
+                switch (block[i]) {
+                    case '{':
+                    case '[':
+                        depth++;
+                        break;
+                    case '}':
+                    case ']':
+                        if (--depth == 0) {
+                            found = offset + i;
+                            return false;
+                        }
+                        break;
+                    case ',':
+                        if (commas && depth == 1) {
+                            found = offset + i;
+                            return false;
+                        }
+                        break;
+                    default:
+                        break;
+                }
+            }
+            return true;
+        });
+        return found;
+    }
+
+}
+
+void neroll::find_structurals(std::string_view json, std::size_t begin, std::size_t size, StructuralIndex &index) {
+    static const Classifier classify = pick_classifier();
+
+    size = std::min(size, json.size() - begin);
+    index.begin = begin;
+    index.end = begin + size;
+    auto &positions = index.positions;
+    auto &breaks = index.string_breaks;
+    if (positions.size() < size / 8 + 64)
+        positions.resize(size / 8 + 64);
+    breaks.resize((size + 63) / 64);
+    std::size_t count = 0;
+    StructuralScanner scanner;
+
+    // writes eight positions at a time, the slack at the end of the vector
+    // absorbs the extra ones
+    auto flatten = [&](std::uint64_t bits, std::size_t base) {
+        if (count + 64 > positions.size())
+            positions.resize(positions.size() * 2);
+        std::uint32_t *out = positions.data() + count;
+        count += std::popcount(bits);
+        while (bits != 0) {
+            for (int i = 0; i < 8; i++) {
+                out[i] = static_cast<std::uint32_t>(base + std::countr_zero(bits));
+                bits &= bits - 1;
+            }
+            out += 8;
+        }
+    };
+    auto scan = [&](const char *block, std::size_t offset) {
+        auto masks = classify(block);
+        breaks[offset / 64] = masks.quote | masks.backslash | masks.control;
+        flatten(scanner.scan(masks), begin + offset);
+    };
+
+    const char *window = json.data() + begin;
+    std::size_t offset = 0;
+    for (; offset + 64 <= size; offset += 64)
+        scan(window + offset, offset);
+
+    if (offset < size) {
+        // pad the tail with whitespace, which never produces a position
+        char block[64];
+        std::memset(block, ' ', sizeof(block));
+        std::memcpy(block, window + offset, size - offset);
+        scan(block, offset);
+    }
+    index.count = count;
+}
+
+auto neroll::find_structurals(std::string_view json) -> std::vector<std::uint32_t> {
+    StructuralIndex index;
+    find_structurals(json, 0, json.size(), index);
+    index.positions.resize(index.count);
+    return std::move(index.positions);
+}
+
+auto neroll::StructuralIndex::next_break(std::size_t from, std::size_t to) const -> std::size_t {
+    if (from >= to)
+        return to;
+    auto word = (from - begin) / 64;
+    auto bits = string_breaks[word] & (~std::uint64_t{0} << ((from - begin) % 64));
+    auto last = (to - 1 - begin) / 64;
+    while (bits == 0) {
+        if (word == last)
+            return to;
+        bits = string_breaks[++word];
+    }
+    return std::min(begin + word * 64 + std::countr_zero(bits), to);
+}
+
+auto neroll::summarize_range(std::string_view json, std::size_t begin, std::size_t end) -> RangeSummary {
+    RangeSummary summary;
+    StructuralScanner scanner(false, is_escaped(json, begin));
+    for_each_block(json, begin, end, [&](const BlockMasks &masks, const char *block, std::size_t) {
+        // a byte inside a string when the piece starts outside of one is
+        // outside of a string when it starts inside, and the other way round
+        std::uint64_t in_string = scanner.strings(masks);
+        for (auto bits = masks.op; bits != 0; bits &= bits - 1) {
+            int i = std::countr_zero(bits);
+            auto side = (in_string >> i) & 1;
+            switch (block[i]) {
+                case '{':
+                case '[':
+                    summary.depth[side]++;
+                    break;
+                case '}':
+                case ']':
+                    summary.depth[side]--;
+                    summary.min_depth[side] = std::min(summary.min_depth[side], summary.depth[side]);
+                    break;
+                default:
+                    break;
+            }
+        }
+        return true;
+    });
+    summary.odd_quotes = scanner.in_string();
+    return summary;
+}
+
+auto neroll::find_top_level(std::string_view json, std::size_t begin, std::size_t end,
+        bool in_string, std::size_t depth) -> std::size_t {
+    return find_depth(json, begin, end, in_string, depth, true);
+}
+
+auto neroll::find_close(std::string_view json, std::size_t begin, std::size_t end,
+        bool in_string, std::size_t depth) -> std::size_t {
+    return find_depth(json, begin, end, in_string, depth, false);
+}
@@ -0,0 +1,32 @@
+#include "njson.h"
+
+#include <format>       // format
+
+namespace {
+
+    std::string open_span(std::string_view color) {
+        return std::format(R"(<span style="color: {}">)", color);
+    }
+
+}
+
+neroll::Theme::Theme(const ThemeColors &colors)
+    : number_open_(open_span(colors.number)),
+      string_open_(open_span(colors.string)),
+      bool_open_(open_span(colors.boolean)),
+      null_span_(open_span(colors.null) + "null</span>"),
+      array_open_(open_span(colors.bracket) + "[</span>"),
+      array_close_(open_span(colors.bracket) + "]</span>"),
+      object_open_(open_span(colors.brace) + "{</span>"),
+      object_close_begin_(open_span(colors.brace) + "<br/>") {}
+
+auto neroll::Theme::default_theme() -> std::shared_ptr<const Theme> {
+    static const auto theme = std::make_shared<const Theme>(DEFAULT_THEME_COLORS);
+    return theme;
+}
+
+auto neroll::Theme::load(const std::string &path) -> std::shared_ptr<const Theme> {
+    // the colors point into the file, which outlives the Theme's constructor
+    MappedFile file(path);
+    return std::make_shared<const Theme>(from_json<ThemeColors>(file.data()));
+}
@@ -0,0 +1,35 @@
+#include "njson.h"
+
+#include <stdexcept>    // runtime_error
+#include <format>       // format
+
+void neroll::TypedReader::open(TokenType type, std::string_view expect) {
+    if (token_.type != type)
+        throw_type_error(expect);
+    if (depth_ >= options_.max_depth)
+        throw_error(std::format("nesting is deeper than the maximum depth {}", options_.max_depth));
+    depth_++;
+    move();
+}
+
+// unknown members are passed over without being validated
+void neroll::TypedReader::skip_value() {
+    lexer_.expect_value(token_);
+    lexer_.skip_value(token_);
+}
+
+void neroll::TypedReader::throw_error(std::string_view message) const {
+    lexer_.throw_error(token_.offset, message);
+}
+
+void neroll::TypedReader::throw_type_error(std::string_view expect) const {
+    throw_error(std::format("expect {}, found {}", expect, token_.name()));
+}
+
+void neroll::TypedReader::throw_duplicate_key(const Token &key) const {
+    lexer_.throw_error(key.offset, std::format("duplicate key {}", key.content));
+}
+
+void neroll::TypedReader::throw_missing_key(std::string_view key) const {
+    throw_error(std::format("missing key \"{}\"", key));
+}
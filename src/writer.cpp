@@ -0,0 +1,231 @@
+#include "njson.h"
+
+#include <charconv>     // to_chars
+#include <cmath>        // isfinite
+
+// define NJSON_NO_SIMD to always use the portable scan
+#if !defined(NJSON_NO_SIMD) && defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define NJSON_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+    bool needs_escape(char ch) {
+        return ch == '\"' || ch == '\\' || static_cast<unsigned char>(ch) < 0x20;
+    }
+
+    // offset of the first character of `text` from `begin` on that needs
+    // an escape, or the size of `text`
+    std::size_t find_escape(std::string_view text, std::size_t begin) {
+        const char *data = text.data();
+        std::size_t i = begin;
+#ifdef NJSON_X86_SIMD
+        // SSE2 is part of x86-64, so this path needs no runtime check
+        const __m128i quote = _mm_set1_epi8('\"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i control = _mm_set1_epi8(0x1f);
+        for (; i + 16 <= text.size(); i += 16) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            // unsigned bytes <= 0x1f are the ones max() leaves at 0x1f
+            __m128i result = _mm_or_si128(_mm_cmpeq_epi8(bytes, quote), _mm_cmpeq_epi8(bytes, backslash));
+            result = _mm_or_si128(result, _mm_cmpeq_epi8(_mm_max_epu8(bytes, control), control));
+            int mask = _mm_movemask_epi8(result);
+            if (mask != 0)
+                return i + __builtin_ctz(static_cast<unsigned>(mask));
+        }
+#endif
+        for (; i < text.size(); i++) {
+            if (needs_escape(data[i]))
+                return i;
+        }
+        return text.size();
+    }
+
+    // runs without escapes are copied in one piece
+    void append_string(std::string &out, std::string_view value) {
+        out.push_back('\"');
+        std::size_t plain = 0;
+        for (auto i = find_escape(value, 0); i < value.size(); i = find_escape(value, plain)) {
+            out.append(value.substr(plain, i - plain));
+            switch (value[i]) {
+                case '\"':
+                    out.append(R"(\")");
+                    break;
+                case '\\':
+                    out.append(R"(\\)");
+                    break;
+                case '\b':
+                    out.append(R"(\b)");
+                    break;
+                case '\f':
+                    out.append(R"(\f)");
+                    break;
+                case '\n':
+                    out.append(R"(\n)");
+                    break;
+                case '\r':
+                    out.append(R"(\r)");
+                    break;
+                case '\t':
+                    out.append(R"(\t)");
+                    break;
+                default:
+                    out.append(R"(\u00)");
+                    out.push_back("0123456789abcdef"[value[i] >> 4]);
+                    out.push_back("0123456789abcdef"[value[i] & 0xf]);
+                    break;
+            }
+            plain = i + 1;
+        }
+        out.append(value.substr(plain));
+        out.push_back('\"');
+    }
+
+    void append_double(std::string &out, double value) {
+        // json has no infinity or nan
+        if (!std::isfinite(value)) {
+            out.append("null");
+            return;
+        }
+        // the shortest round trip form takes at most 24 characters
+        char number[32];
+        auto end = std::to_chars(number, number + sizeof(number), value).ptr;
+        out.append(number, end);
+        if (std::string_view(number, end - number).find_first_of(".e") == std::string_view::npos)
+            out.append(".0");
+    }
+
+}
+
+auto neroll::JsonWriter::to_json(AstNode node) -> std::string_view {
+    write(node, nullptr);
+    return buffer_;
+}
+
+void neroll::JsonWriter::to_json(AstNode node, Sink &sink) {
+    write(node, &sink);
+    sink.write(buffer_);
+}
+
+// Walks the tree with an explicit stack like Stringifier. With a sink the
+// buffer is handed over whenever it grows past BufferedSink::BUFFER_SIZE.
+void neroll::JsonWriter::write(AstNode node, Sink *sink) {
+    buffer_.clear();
+    stack_.clear();
+    write_value(node);
+    while (!stack_.empty()) {
+        if (sink && buffer_.size() >= BufferedSink::BUFFER_SIZE) {
+            sink->write(buffer_);
+            buffer_.clear();
+        }
+
+        auto &frame = stack_.back();
+        bool array = frame.type == AstType::ARRAY;
+        if (array ? frame.element == frame.elements_end : frame.member == frame.members_end) {
+            bool empty = frame.first;
+            stack_.pop_back();
+            if (!empty)
+                new_line(stack_.size());
+            buffer_.push_back(array ? ']' : '}');
+            continue;
+        }
+
+        if (!frame.first)
+            buffer_.push_back(',');
+        frame.first = false;
+        new_line(stack_.size());
+        if (array) {
+            auto element = *frame.element;
+            ++frame.element;
+            write_value(element);
+        } else {
+            auto [key, value] = *frame.member;
+            ++frame.member;
+            write_string(key);
+            buffer_.push_back(':');
+            if (options_.indent > 0)
+                buffer_.push_back(' ');
+            write_value(value);
+        }
+    }
+}
+
+// writes a scalar, or the opening bracket of a container and pushes it
+void neroll::JsonWriter::write_value(AstNode node) {
+    // integers take at most 20 characters
+    char number[32];
+    switch (node.type()) {
+        case AstType::INT: {
+            auto end = std::to_chars(number, number + sizeof(number), IntNode(node).value()).ptr;
+            buffer_.append(number, end);
+        }
+        break;
+        case AstType::FLOAT:
+            write_double(FloatNode(node).value());
+            break;
+        case AstType::BOOLEAN:
+            buffer_.append(BooleanNode(node).value() ? "true" : "false");
+            break;
+        case AstType::NIL:
+            buffer_.append("null");
+            break;
+        case AstType::STRING:
+            write_string(StringNode(node).value());
+            break;
+        case AstType::ARRAY: {
+            ArrayNode array(node);
+            buffer_.push_back('[');
+            stack_.push_back({AstType::ARRAY, array.begin(), array.end(), {}, {}});
+        }
+        break;
+        case AstType::OBJECT: {
+            ObjectNode object(node);
+            buffer_.push_back('{');
+            stack_.push_back({AstType::OBJECT, {}, {}, object.begin(), object.end()});
+        }
+        break;
+    }
+}
+
+void neroll::JsonWriter::write_string(std::string_view value) {
+    append_string(buffer_, value);
+}
+
+void neroll::JsonWriter::write_double(double value) {
+    append_double(buffer_, value);
+}
+
+void neroll::JsonWriter::new_line(std::size_t depth) {
+    if (options_.indent <= 0)
+        return;
+    buffer_.push_back('\n');
+    buffer_.append(depth * options_.indent, ' ');
+}
+
+void neroll::TypedWriter::write_integer(std::int64_t value) {
+    char number[32];
+    auto end = std::to_chars(number, number + sizeof(number), value).ptr;
+    buffer_.append(number, end);
+}
+
+void neroll::TypedWriter::write_unsigned(std::uint64_t value) {
+    char number[32];
+    auto end = std::to_chars(number, number + sizeof(number), value).ptr;
+    buffer_.append(number, end);
+}
+
+void neroll::TypedWriter::write_double(double value) {
+    append_double(buffer_, value);
+}
+
+void neroll::TypedWriter::write_string(std::string_view value) {
+    append_string(buffer_, value);
+}
+
+void neroll::TypedWriter::new_line(std::size_t depth) {
+    if (options_.indent <= 0)
+        return;
+    buffer_.push_back('\n');
+    buffer_.append(depth * options_.indent, ' ');
+}
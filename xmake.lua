@@ -3,8 +3,29 @@ add_rules("mode.debug", "mode.release")
 set_languages("c++20")
 set_warnings("all", "error")
 
+option("stats")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Collect parse and render stats (Parser::stats and friends)")
+    add_defines("NJSON_STATS")
+option_end()
+
+target("njson_lib")
+    set_kind("static")
+    add_includedirs("include", {public = true})
+    add_files("src/*.cpp|main.cpp")
+    add_syslinks("pthread", {public = true})
+    add_options("stats", {public = true})
+
 target("njson")
     set_kind("binary")
-    add_includedirs("include")
-    add_files("src/*.cpp")
-    set_rundir("$(projectdir)")
\ No newline at end of file
+    add_deps("njson_lib")
+    add_files("src/main.cpp")
+    set_rundir("$(projectdir)")
+
+-- throughput of the lexer, parser and writers on generated corpora:
+-- xmake run njson_bench [--size MB] [--runs N] [--json FILE]
+target("njson_bench")
+    set_kind("binary")
+    add_deps("njson_lib")
+    add_files("bench/bench.cpp")